@@ -19,10 +19,16 @@
 #define DISTRHO_PLUGIN_NUM_INPUTS 0
 
 /**
-   Number of audio outputs the plugin has.
+   Number of audio outputs the plugin has.@n
+   The multi-out build adds a stereo pair for each of the kMaxChips (4) chips of the pool after the main mix,
+   PluginDSP.cpp checks the two agree.
    @note This macro is required.
  */
+#ifdef VGM_MULTI_OUT
+#define DISTRHO_PLUGIN_NUM_OUTPUTS (2 + 2 * 4)
+#else
 #define DISTRHO_PLUGIN_NUM_OUTPUTS 2
+#endif
 
 /**
    The plugin URI when exporting in LV2 format.
@@ -62,7 +68,7 @@
    Whether the plugin introduces latency during audio or midi processing.
    @see Plugin::setLatency(uint32_t)
  */
-#define DISTRHO_PLUGIN_WANT_LATENCY 0
+#define DISTRHO_PLUGIN_WANT_LATENCY 1
 
 /**
    Whether the plugin wants MIDI input.@n
@@ -89,7 +95,7 @@
    @see Plugin::initProgramName(uint32_t, String&)
    @see Plugin::loadProgram(uint32_t)
  */
-#define DISTRHO_PLUGIN_WANT_PROGRAMS 0
+#define DISTRHO_PLUGIN_WANT_PROGRAMS 1
 
 /**
    Whether the plugin uses internal non-parameter data.
@@ -106,7 +112,7 @@
    @note this macro is automatically enabled if a plugin has programs and state, as the key-value state pairs need to be updated when the current program changes.
    @see Plugin::getState(const char*)
  */
-#define DISTRHO_PLUGIN_WANT_FULL_STATE 0
+#define DISTRHO_PLUGIN_WANT_FULL_STATE 1
 
 /**
    Whether the plugin wants time position information from the host.
@@ -0,0 +1,568 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# define VGM_SIMD_SSE 1
+# include <xmmintrin.h>
+# if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define VGM_SIMD_SSE2 1
+#  include <emmintrin.h>
+# endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define VGM_SIMD_NEON 1
+# include <arm_neon.h>
+#endif
+
+/**
+   Instruction set the kernels are built for, their output is only bit-exact between builds of the same one.
+ */
+static inline const char* simdName() noexcept
+{
+#if defined(VGM_SIMD_SSE2)
+    return "sse2";
+#elif defined(VGM_SIMD_SSE)
+    return "sse";
+#elif defined(VGM_SIMD_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Block processing kernels, 4 frames at a time with SSE or NEON and a scalar tail
+
+/**
+   @a buffer *= @a gain
+ */
+static inline void applyGain(float* buffer, float gain, uint32_t frames) noexcept
+{
+    uint32_t i = 0;
+
+#if defined(VGM_SIMD_SSE)
+    const __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= frames; i += 4)
+        _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), g));
+#elif defined(VGM_SIMD_NEON)
+    const float32x4_t g = vdupq_n_f32(gain);
+    for (; i + 4 <= frames; i += 4)
+        vst1q_f32(buffer + i, vmulq_f32(vld1q_f32(buffer + i), g));
+#endif
+
+    for (; i < frames; ++i)
+        buffer[i] *= gain;
+}
+
+/**
+   @a buffer *= @a ramp, sample by sample
+ */
+static inline void applyGainRamp(float* buffer, const float* ramp, uint32_t frames) noexcept
+{
+    uint32_t i = 0;
+
+#if defined(VGM_SIMD_SSE)
+    for (; i + 4 <= frames; i += 4)
+        _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), _mm_loadu_ps(ramp + i)));
+#elif defined(VGM_SIMD_NEON)
+    for (; i + 4 <= frames; i += 4)
+        vst1q_f32(buffer + i, vmulq_f32(vld1q_f32(buffer + i), vld1q_f32(ramp + i)));
+#endif
+
+    for (; i < frames; ++i)
+        buffer[i] *= ramp[i];
+}
+
+/**
+   @a buffer += @a source
+ */
+static inline void addBuffer(float* buffer, const float* source, uint32_t frames) noexcept
+{
+    uint32_t i = 0;
+
+#if defined(VGM_SIMD_SSE)
+    for (; i + 4 <= frames; i += 4)
+        _mm_storeu_ps(buffer + i, _mm_add_ps(_mm_loadu_ps(buffer + i), _mm_loadu_ps(source + i)));
+#elif defined(VGM_SIMD_NEON)
+    for (; i + 4 <= frames; i += 4)
+        vst1q_f32(buffer + i, vaddq_f32(vld1q_f32(buffer + i), vld1q_f32(source + i)));
+#endif
+
+    for (; i < frames; ++i)
+        buffer[i] += source[i];
+}
+
+/**
+   @a outL += @a in.L * gainL, @a outR += @a in.R * gainR, where @a in is interleaved 32-bit integer stereo.@n
+   The gains ramp linearly, by @a stepL and @a stepR every frame.
+ */
+static inline void mixStereoRamp(const int32_t* in, float* outL, float* outR,
+                                 float gainL, float gainR, float stepL, float stepR, uint32_t frames) noexcept
+{
+    uint32_t i = 0;
+
+#if defined(VGM_SIMD_SSE2)
+    const __m128 step4L = _mm_set1_ps(stepL * 4.0f);
+    const __m128 step4R = _mm_set1_ps(stepR * 4.0f);
+    __m128 gl = _mm_setr_ps(gainL, gainL + stepL, gainL + stepL * 2.0f, gainL + stepL * 3.0f);
+    __m128 gr = _mm_setr_ps(gainR, gainR + stepR, gainR + stepR * 2.0f, gainR + stepR * 3.0f);
+    for (; i + 4 <= frames; i += 4)
+    {
+        // L0 R0 L1 R1 and L2 R2 L3 R3, deinterleaved once converted
+        const __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 2)));
+        const __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 2 + 4)));
+        const __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(outL + i, _mm_add_ps(_mm_loadu_ps(outL + i), _mm_mul_ps(l, gl)));
+        _mm_storeu_ps(outR + i, _mm_add_ps(_mm_loadu_ps(outR + i), _mm_mul_ps(r, gr)));
+        gl = _mm_add_ps(gl, step4L);
+        gr = _mm_add_ps(gr, step4R);
+    }
+#elif defined(VGM_SIMD_NEON)
+    const float32x4_t step4L = vdupq_n_f32(stepL * 4.0f);
+    const float32x4_t step4R = vdupq_n_f32(stepR * 4.0f);
+    const float offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t gl = vmlaq_n_f32(vdupq_n_f32(gainL), vld1q_f32(offsets), stepL);
+    float32x4_t gr = vmlaq_n_f32(vdupq_n_f32(gainR), vld1q_f32(offsets), stepR);
+    for (; i + 4 <= frames; i += 4)
+    {
+        const int32x4x2_t lr = vld2q_s32(in + i * 2);
+        vst1q_f32(outL + i, vmlaq_f32(vld1q_f32(outL + i), vcvtq_f32_s32(lr.val[0]), gl));
+        vst1q_f32(outR + i, vmlaq_f32(vld1q_f32(outR + i), vcvtq_f32_s32(lr.val[1]), gr));
+        gl = vaddq_f32(gl, step4L);
+        gr = vaddq_f32(gr, step4R);
+    }
+#endif
+
+    for (; i < frames; ++i)
+    {
+        outL[i] += in[i * 2] * (gainL + stepL * i);
+        outR[i] += in[i * 2 + 1] * (gainR + stepR * i);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Cascade of up to kMaxStages biquads in transposed direct form II, filtering up to 4 channels at once.@n
+   Each channel is a SIMD lane and all channels share the coefficients, so two stereo buses cost one pass.
+   A stereo pair through two stages runs both stages side by side instead, the second one a frame behind,
+   so the main mix of the stereo build fills the lanes too.
+ */
+class BiquadCascade
+{
+public:
+    static constexpr const uint32_t kMaxStages = 2;
+    static constexpr const uint32_t kLanes = 4;
+    static constexpr const float kPi = 3.14159265f;
+
+    struct Coefficients {
+        float b0, b1, b2, a1, a2; // normalized, a0 = 1
+    };
+
+   /**
+      RBJ cookbook low-pass and high-pass sections.
+    */
+    static Coefficients lowPass(float frequency, float q, float sampleRate) noexcept
+    {
+        const float w = 2.0f * kPi * std::fmin(frequency, sampleRate * 0.45f) / sampleRate;
+        const float alpha = std::sin(w) / (2.0f * q);
+        const float cosw = std::cos(w);
+        const float a0 = 1.0f + alpha;
+        const float b1 = (1.0f - cosw) / a0;
+        return { b1 * 0.5f, b1, b1 * 0.5f, -2.0f * cosw / a0, (1.0f - alpha) / a0 };
+    }
+
+    static Coefficients highPass(float frequency, float q, float sampleRate) noexcept
+    {
+        const float w = 2.0f * kPi * std::fmin(frequency, sampleRate * 0.45f) / sampleRate;
+        const float alpha = std::sin(w) / (2.0f * q);
+        const float cosw = std::cos(w);
+        const float a0 = 1.0f + alpha;
+        const float b1 = -(1.0f + cosw) / a0;
+        return { b1 * -0.5f, b1, b1 * -0.5f, -2.0f * cosw / a0, (1.0f - alpha) / a0 };
+    }
+
+   /**
+      Replace the stages, 0 stages bypasses the filter. The state is kept.
+    */
+    void setStages(const Coefficients* stages, uint32_t count) noexcept
+    {
+        fStageCount = count < kMaxStages ? count : kMaxStages;
+
+        for (uint32_t s = 0; s < fStageCount; ++s)
+            fStages[s] = stages[s];
+    }
+
+    bool isBypassed() const noexcept
+    {
+        return fStageCount == 0;
+    }
+
+    void reset() noexcept
+    {
+        for (uint32_t s = 0; s < kMaxStages; ++s)
+            for (uint32_t l = 0; l < kLanes; ++l)
+                fState[s][0][l] = fState[s][1][l] = 0.0f;
+    }
+
+   /**
+      Filter @a count channels (at most kLanes) in place.
+    */
+    void process(float* const* channels, uint32_t count, uint32_t frames) noexcept
+    {
+        if (fStageCount == 0)
+            return;
+
+#if defined(VGM_SIMD_SSE) || defined(VGM_SIMD_NEON)
+        if (count == 2 && fStageCount == 2)
+        {
+            if (frames != 0)
+                processStereo(channels[0], channels[1], frames);
+            return;
+        }
+#endif
+
+        float lanes[kLanes] = {};
+
+#if defined(VGM_SIMD_SSE)
+        __m128 s1[kMaxStages], s2[kMaxStages];
+        for (uint32_t s = 0; s < fStageCount; ++s)
+        {
+            s1[s] = _mm_loadu_ps(fState[s][0]);
+            s2[s] = _mm_loadu_ps(fState[s][1]);
+        }
+
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            for (uint32_t l = 0; l < count; ++l)
+                lanes[l] = channels[l][i];
+
+            __m128 x = _mm_loadu_ps(lanes);
+
+            for (uint32_t s = 0; s < fStageCount; ++s)
+            {
+                const Coefficients& c = fStages[s];
+                const __m128 y = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(c.b0), x), s1[s]);
+                s1[s] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(c.b1), x), _mm_mul_ps(_mm_set1_ps(c.a1), y)), s2[s]);
+                s2[s] = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(c.b2), x), _mm_mul_ps(_mm_set1_ps(c.a2), y));
+                x = y;
+            }
+
+            _mm_storeu_ps(lanes, x);
+
+            for (uint32_t l = 0; l < count; ++l)
+                channels[l][i] = lanes[l];
+        }
+
+        for (uint32_t s = 0; s < fStageCount; ++s)
+        {
+            _mm_storeu_ps(fState[s][0], s1[s]);
+            _mm_storeu_ps(fState[s][1], s2[s]);
+        }
+#elif defined(VGM_SIMD_NEON)
+        float32x4_t s1[kMaxStages], s2[kMaxStages];
+        for (uint32_t s = 0; s < fStageCount; ++s)
+        {
+            s1[s] = vld1q_f32(fState[s][0]);
+            s2[s] = vld1q_f32(fState[s][1]);
+        }
+
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            for (uint32_t l = 0; l < count; ++l)
+                lanes[l] = channels[l][i];
+
+            float32x4_t x = vld1q_f32(lanes);
+
+            for (uint32_t s = 0; s < fStageCount; ++s)
+            {
+                const Coefficients& c = fStages[s];
+                const float32x4_t y = vmlaq_n_f32(s1[s], x, c.b0);
+                s1[s] = vmlsq_n_f32(vmlaq_n_f32(s2[s], x, c.b1), y, c.a1);
+                s2[s] = vmlsq_n_f32(vmulq_n_f32(x, c.b2), y, c.a2);
+                x = y;
+            }
+
+            vst1q_f32(lanes, x);
+
+            for (uint32_t l = 0; l < count; ++l)
+                channels[l][i] = lanes[l];
+        }
+
+        for (uint32_t s = 0; s < fStageCount; ++s)
+        {
+            vst1q_f32(fState[s][0], s1[s]);
+            vst1q_f32(fState[s][1], s2[s]);
+        }
+#else
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            for (uint32_t l = 0; l < count; ++l)
+            {
+                float x = channels[l][i];
+
+                for (uint32_t s = 0; s < fStageCount; ++s)
+                {
+                    const Coefficients& c = fStages[s];
+                    float* const state = fState[s][0];
+                    const float y = c.b0 * x + state[l];
+                    state[l] = c.b1 * x - c.a1 * y + fState[s][1][l];
+                    fState[s][1][l] = c.b2 * x - c.a2 * y;
+                    x = y;
+                }
+
+                channels[l][i] = x;
+            }
+        }
+        (void)lanes;
+#endif
+    }
+
+private:
+#if defined(VGM_SIMD_SSE) || defined(VGM_SIMD_NEON)
+   /**
+      Two stages over two channels, stage 1 in lanes 0 and 1 on frame i while stage 2 in lanes 2 and 3 is on frame
+      i - 1. The first and last steps run a single stage, the lanes of the other one keep their state.@n
+      Every sample goes through the same operations as in process(), the output is the same.
+    */
+    void processStereo(float* left, float* right, uint32_t frames) noexcept
+    {
+        const Coefficients& c1 = fStages[0];
+        const Coefficients& c2 = fStages[1];
+        float lanes[kLanes] = {};
+
+# if defined(VGM_SIMD_SSE)
+        const __m128 b0 = _mm_setr_ps(c1.b0, c1.b0, c2.b0, c2.b0);
+        const __m128 b1 = _mm_setr_ps(c1.b1, c1.b1, c2.b1, c2.b1);
+        const __m128 b2 = _mm_setr_ps(c1.b2, c1.b2, c2.b2, c2.b2);
+        const __m128 a1 = _mm_setr_ps(c1.a1, c1.a1, c2.a1, c2.a1);
+        const __m128 a2 = _mm_setr_ps(c1.a2, c1.a2, c2.a2, c2.a2);
+        __m128 s1 = _mm_movelh_ps(_mm_loadu_ps(fState[0][0]), _mm_loadu_ps(fState[1][0]));
+        __m128 s2 = _mm_movelh_ps(_mm_loadu_ps(fState[0][1]), _mm_loadu_ps(fState[1][1]));
+        __m128 y = _mm_setzero_ps();
+
+        const auto step = [&](const __m128& x) {
+            y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+            s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), s2);
+            s2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+        };
+
+        // first stage alone on the first frame
+        {
+            const __m128 p1 = s1, p2 = s2;
+            lanes[0] = left[0];
+            lanes[1] = right[0];
+            step(_mm_loadu_ps(lanes));
+            s1 = _mm_shuffle_ps(s1, p1, _MM_SHUFFLE(3, 2, 1, 0));
+            s2 = _mm_shuffle_ps(s2, p2, _MM_SHUFFLE(3, 2, 1, 0));
+        }
+
+        for (uint32_t i = 1; i < frames; ++i)
+        {
+            lanes[0] = left[i];
+            lanes[1] = right[i];
+            step(_mm_movelh_ps(_mm_loadu_ps(lanes), y));
+            _mm_storeu_ps(lanes, y);
+            left[i - 1] = lanes[2];
+            right[i - 1] = lanes[3];
+        }
+
+        // second stage alone on the last frame
+        {
+            const __m128 p1 = s1, p2 = s2;
+            step(_mm_movelh_ps(_mm_setzero_ps(), y));
+            s1 = _mm_shuffle_ps(p1, s1, _MM_SHUFFLE(3, 2, 1, 0));
+            s2 = _mm_shuffle_ps(p2, s2, _MM_SHUFFLE(3, 2, 1, 0));
+            _mm_storeu_ps(lanes, y);
+            left[frames - 1] = lanes[2];
+            right[frames - 1] = lanes[3];
+        }
+
+        _mm_storeu_ps(lanes, s1);
+        fState[0][0][0] = lanes[0];
+        fState[0][0][1] = lanes[1];
+        fState[1][0][0] = lanes[2];
+        fState[1][0][1] = lanes[3];
+        _mm_storeu_ps(lanes, s2);
+        fState[0][1][0] = lanes[0];
+        fState[0][1][1] = lanes[1];
+        fState[1][1][0] = lanes[2];
+        fState[1][1][1] = lanes[3];
+# else
+        const float32x4_t b0 = vcombine_f32(vdup_n_f32(c1.b0), vdup_n_f32(c2.b0));
+        const float32x4_t b1 = vcombine_f32(vdup_n_f32(c1.b1), vdup_n_f32(c2.b1));
+        const float32x4_t b2 = vcombine_f32(vdup_n_f32(c1.b2), vdup_n_f32(c2.b2));
+        const float32x4_t a1 = vcombine_f32(vdup_n_f32(c1.a1), vdup_n_f32(c2.a1));
+        const float32x4_t a2 = vcombine_f32(vdup_n_f32(c1.a2), vdup_n_f32(c2.a2));
+        float32x4_t s1 = vcombine_f32(vld1_f32(fState[0][0]), vld1_f32(fState[1][0]));
+        float32x4_t s2 = vcombine_f32(vld1_f32(fState[0][1]), vld1_f32(fState[1][1]));
+        float32x4_t y = vdupq_n_f32(0.0f);
+
+        const auto step = [&](float32x4_t x) {
+            y = vmlaq_f32(s1, x, b0);
+            s1 = vmlsq_f32(vmlaq_f32(s2, x, b1), y, a1);
+            s2 = vmlsq_f32(vmulq_f32(x, b2), y, a2);
+        };
+
+        // first stage alone on the first frame
+        {
+            const float32x4_t p1 = s1, p2 = s2;
+            lanes[0] = left[0];
+            lanes[1] = right[0];
+            step(vld1q_f32(lanes));
+            s1 = vcombine_f32(vget_low_f32(s1), vget_high_f32(p1));
+            s2 = vcombine_f32(vget_low_f32(s2), vget_high_f32(p2));
+        }
+
+        for (uint32_t i = 1; i < frames; ++i)
+        {
+            lanes[0] = left[i];
+            lanes[1] = right[i];
+            step(vcombine_f32(vld1_f32(lanes), vget_low_f32(y)));
+            vst1q_f32(lanes, y);
+            left[i - 1] = lanes[2];
+            right[i - 1] = lanes[3];
+        }
+
+        // second stage alone on the last frame
+        {
+            const float32x4_t p1 = s1, p2 = s2;
+            step(vcombine_f32(vdup_n_f32(0.0f), vget_low_f32(y)));
+            s1 = vcombine_f32(vget_low_f32(p1), vget_high_f32(s1));
+            s2 = vcombine_f32(vget_low_f32(p2), vget_high_f32(s2));
+            vst1q_f32(lanes, y);
+            left[frames - 1] = lanes[2];
+            right[frames - 1] = lanes[3];
+        }
+
+        vst1_f32(fState[0][0], vget_low_f32(s1));
+        vst1_f32(fState[1][0], vget_high_f32(s1));
+        vst1_f32(fState[0][1], vget_low_f32(s2));
+        vst1_f32(fState[1][1], vget_high_f32(s2));
+# endif
+    }
+#endif
+
+    Coefficients fStages[kMaxStages] = {};
+    uint32_t fStageCount = 0;
+    float fState[kMaxStages][2][kLanes] = {}; // s1 and s2 of each lane
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   One-pole exponential smoother computing its output a block at a time.@n
+   Same response as DPF's ExponentialValueSmoother, but the block is computed in closed form
+   (target + (current - target) * coef^n) so it vectorizes, and the smoother reports when it has settled
+   so constant gain can skip the ramp entirely.
+ */
+class GainSmoother
+{
+public:
+    static constexpr const float kSettleThreshold = 1e-5f;
+
+    void setSampleRate(float sampleRate) noexcept
+    {
+        fSampleRate = sampleRate;
+        updateCoef();
+    }
+
+    void setTimeConstant(float timeConstant) noexcept
+    {
+        fTimeConstant = timeConstant;
+        updateCoef();
+    }
+
+    void setTargetValue(float target) noexcept
+    {
+        fTarget = target;
+    }
+
+    float getTargetValue() const noexcept
+    {
+        return fTarget;
+    }
+
+    float getCurrentValue() const noexcept
+    {
+        return fCurrent;
+    }
+
+    void clearToTargetValue() noexcept
+    {
+        fCurrent = fTarget;
+    }
+
+    bool isSettled() const noexcept
+    {
+        return fCurrent == fTarget;
+    }
+
+   /**
+      Write the next @a frames values of the ramp to @a ramp, @a frames must not be 0.
+    */
+    void process(float* ramp, uint32_t frames) noexcept
+    {
+        const float target = fTarget;
+        const float diff = fCurrent - target;
+        uint32_t i = 0;
+
+#if defined(VGM_SIMD_SSE)
+        const __m128 vt = _mm_set1_ps(target);
+        const __m128 vd = _mm_set1_ps(diff);
+        const __m128 vc4 = _mm_set1_ps(fCoef4);
+        __m128 pw = _mm_setr_ps(fCoef, fCoef * fCoef, fCoef * fCoef * fCoef, fCoef4);
+        for (; i + 4 <= frames; i += 4)
+        {
+            _mm_storeu_ps(ramp + i, _mm_add_ps(vt, _mm_mul_ps(vd, pw)));
+            pw = _mm_mul_ps(pw, vc4);
+        }
+        float p = _mm_cvtss_f32(pw);
+#elif defined(VGM_SIMD_NEON)
+        const float32x4_t vt = vdupq_n_f32(target);
+        const float32x4_t vd = vdupq_n_f32(diff);
+        const float32x4_t vc4 = vdupq_n_f32(fCoef4);
+        const float powers[4] = { fCoef, fCoef * fCoef, fCoef * fCoef * fCoef, fCoef4 };
+        float32x4_t pw = vld1q_f32(powers);
+        for (; i + 4 <= frames; i += 4)
+        {
+            vst1q_f32(ramp + i, vmlaq_f32(vt, vd, pw));
+            pw = vmulq_f32(pw, vc4);
+        }
+        float p = vgetq_lane_f32(pw, 0);
+#else
+        float p = fCoef;
+#endif
+
+        for (; i < frames; ++i, p *= fCoef)
+            ramp[i] = target + diff * p;
+
+        fCurrent = ramp[frames - 1];
+
+        if (std::fabs(fCurrent - target) < kSettleThreshold)
+            fCurrent = target;
+    }
+
+private:
+    void updateCoef() noexcept
+    {
+        fCoef = fTimeConstant > 0.0f && fSampleRate > 0.0f ? std::exp(-1.0f / (fTimeConstant * fSampleRate)) : 0.0f;
+        fCoef4 = fCoef * fCoef * fCoef * fCoef;
+    }
+
+    float fSampleRate = 44100.0f;
+    float fTimeConstant = 0.0f;
+    float fCoef = 0.0f;
+    float fCoef4 = 0.0f;
+    float fTarget = 0.0f;
+    float fCurrent = 0.0f;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
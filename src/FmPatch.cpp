@@ -0,0 +1,299 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "FmPatch.hpp"
+#include "VgmChip.hpp"
+
+#include <json.hpp>
+
+#include <array>
+#include <cmath>
+#include <fstream>
+
+using json = nlohmann::json;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// register offsets of operators 1-4, the chip orders its slots 1-3-2-4
+static constexpr const uint8_t kOperatorOffsets[4] = { 0x0, 0x8, 0x4, 0xC };
+
+static constexpr const uint8_t kCarrierMasks[8] = { 0x8, 0x8, 0x8, 0x8, 0xA, 0xE, 0xE, 0xF };
+
+// channel registers in FmRegisterImage order, without the channel offset
+static constexpr const uint8_t kImageRegisters[FmRegisterImage::kSize] = {
+    0x30, 0x38, 0x34, 0x3C, 0x40, 0x48, 0x44, 0x4C, 0x50, 0x58, 0x54, 0x5C, 0x60, 0x68, 0x64, 0x6C,
+    0x70, 0x78, 0x74, 0x7C, 0x80, 0x88, 0x84, 0x8C, 0x90, 0x98, 0x94, 0x9C, 0xB0, 0xB4
+};
+
+static const FmPatch kDefaultPatch = [] {
+    FmPatch p;
+    p.name = "Init";
+    p.alg = 4;
+    p.fb = 5;
+    p.ops[0] = { 31, 8, 0, 7, 2, 35, 0, 1, 3, 0, 0 };
+    p.ops[1] = { 31, 6, 2, 7, 3, 0, 0, 1, 0, 0, 0 };
+    p.ops[2] = { 31, 10, 0, 7, 2, 40, 0, 4, 0, 0, 0 };
+    p.ops[3] = { 31, 6, 2, 7, 3, 4, 0, 1, 0, 0, 0 };
+    return p;
+}();
+
+static const FmRegisterImage kDefaultImage = [] {
+    FmRegisterImage image;
+    image.build(kDefaultPatch);
+    return image;
+}();
+
+// 40dB of velocity range, one TL step is 0.75dB
+static const std::array<uint8_t, 128> kVelocityAttenuation = [] {
+    std::array<uint8_t, 128> t;
+    t[0] = 127;
+    for (int v = 1; v < 128; ++v)
+        t[v] = static_cast<uint8_t>(std::lround(-40.0 * std::log10(v / 127.0) / 0.75));
+    return t;
+}();
+
+uint8_t FmPatch::carrierMask() const noexcept
+{
+    return kCarrierMasks[alg & 7];
+}
+
+void FmRegisterImage::build(const FmPatch& patch) noexcept
+{
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        const FmOperator& op = patch.ops[i];
+
+        // registers are grouped by type, 4 operators each
+        data[i] = (op.dt << 4) | op.ml;
+        data[4 + i] = op.tl;
+        data[8 + i] = (op.ks << 6) | op.ar;
+        data[12 + i] = (op.am << 7) | op.dr;
+        data[16 + i] = op.sr;
+        data[20 + i] = (op.sl << 4) | op.rr;
+        data[24 + i] = op.ssg;
+        tl[i] = op.tl;
+    }
+
+    data[28] = (patch.fb << 3) | patch.alg;
+    data[29] = 0xC0 | (patch.ams << 4) | patch.pms;
+    carriers = patch.carrierMask();
+}
+
+void PatchLibrary::prepare()
+{
+    images.resize(banks.size() * 128);
+    slots.assign(kBankCount, kNoSlot);
+
+    for (size_t b = 0; b < banks.size(); ++b)
+    {
+        const PatchBank& bank = banks[b];
+
+        if (slots[bank.number] == kNoSlot)
+            slots[bank.number] = static_cast<uint16_t>(b);
+
+        for (size_t p = 0; p < 128; ++p)
+            images[b * 128 + p].build(bank.patches.empty() ? kDefaultPatch : bank.patches[p % bank.patches.size()]);
+    }
+}
+
+const FmRegisterImage& PatchLibrary::get(uint16_t bank, uint8_t program) const noexcept
+{
+    if (images.empty())
+        return kDefaultImage;
+
+    uint16_t slot = slots[bank % kBankCount];
+    if (slot == kNoSlot)
+        slot = 0;
+
+    return images[slot * 128 + (program & 0x7F)];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static uint8_t readValue(const json& j, const char* key, uint8_t def, uint8_t mask)
+{
+    return static_cast<uint8_t>(j.value(key, int(def)) & mask);
+}
+
+static void readBank(const json& j, PatchBank& bank)
+{
+    bank.name = j.value("name", "");
+    bank.number = static_cast<uint16_t>((readValue(j, "msb", 0, 0x7F) << 7) | readValue(j, "lsb", 0, 0x7F));
+    bank.patches.clear();
+
+    for (const json& jp : j.at("patches"))
+    {
+        FmPatch patch;
+        patch.name = jp.value("name", "");
+        patch.alg = readValue(jp, "alg", patch.alg, 7);
+        patch.fb = readValue(jp, "fb", patch.fb, 7);
+        patch.ams = readValue(jp, "ams", patch.ams, 3);
+        patch.pms = readValue(jp, "pms", patch.pms, 7);
+
+        const json& jops = jp.at("ops");
+        for (size_t i = 0; i < 4 && i < jops.size(); ++i)
+        {
+            const json& jo = jops[i];
+            FmOperator& op = patch.ops[i];
+            op.ar = readValue(jo, "ar", op.ar, 31);
+            op.dr = readValue(jo, "dr", op.dr, 31);
+            op.sr = readValue(jo, "sr", op.sr, 31);
+            op.rr = readValue(jo, "rr", op.rr, 15);
+            op.sl = readValue(jo, "sl", op.sl, 15);
+            op.tl = readValue(jo, "tl", op.tl, 127);
+            op.ks = readValue(jo, "ks", op.ks, 3);
+            op.ml = readValue(jo, "ml", op.ml, 15);
+            op.dt = readValue(jo, "dt", op.dt, 7);
+            op.am = readValue(jo, "am", op.am, 1);
+            op.ssg = readValue(jo, "ssg", op.ssg, 15);
+        }
+
+        bank.patches.push_back(std::move(patch));
+    }
+}
+
+bool loadPatchLibrary(const char* filename, PatchLibrary& library, std::string& error)
+{
+    try {
+        std::ifstream file(filename);
+        if (! file.is_open())
+        {
+            error = "cannot open file";
+            return false;
+        }
+
+        const json j = json::parse(file);
+
+        library.banks.clear();
+
+        if (j.contains("banks"))
+        {
+            for (const json& jb : j.at("banks"))
+            {
+                library.banks.emplace_back();
+                readBank(jb, library.banks.back());
+            }
+        }
+        else
+        {
+            library.banks.emplace_back();
+            readBank(j, library.banks.back());
+        }
+
+        library.prepare();
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static inline void writeChannel(VgmChip& chip, uint8_t channel, uint8_t reg, uint8_t data) noexcept
+{
+    chip.write(channel / 3, reg + channel % 3, data);
+}
+
+void ym2612Init(VgmChip& chip)
+{
+    chip.write(0, 0x22, 0x00); // LFO off
+    chip.write(0, 0x27, 0x00); // channel 3 normal mode, timers off
+    chip.write(0, 0x2B, 0x00); // DAC off
+
+    for (uint8_t ch = 0; ch < kYm2612Channels; ++ch)
+    {
+        ym2612KeyOff(chip, ch);
+        writeChannel(chip, ch, 0xB4, 0xC0);
+    }
+}
+
+void ym2612WriteImage(VgmChip& chip, uint8_t channel, const FmRegisterImage& image)
+{
+    const uint8_t port = channel / 3;
+    const uint8_t offset = channel % 3;
+
+    for (uint8_t i = 0; i < FmRegisterImage::kSize; ++i)
+        chip.write(port, kImageRegisters[i] + offset, image.data[i]);
+}
+
+void ym2612WriteLevel(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, uint8_t attenuation)
+{
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        if ((image.carriers & (1 << i)) == 0)
+            continue;
+
+        const int tl = image.tl[i] + attenuation;
+        writeChannel(chip, channel, 0x40 + kOperatorOffsets[i], tl < 127 ? tl : 127);
+    }
+}
+
+void ym2612WriteModulatorLevel(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, int offset)
+{
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        if ((image.carriers & (1 << i)) != 0)
+            continue;
+
+        const int tl = image.tl[i] + offset;
+        writeChannel(chip, channel, 0x40 + kOperatorOffsets[i], tl < 0 ? 0 : tl < 127 ? tl : 127);
+    }
+}
+
+void ym2612WritePitch(VgmChip& chip, uint8_t channel, uint16_t blockFnum)
+{
+    // the high byte is latched until the low byte is written
+    writeChannel(chip, channel, 0xA4, blockFnum >> 8);
+    writeChannel(chip, channel, 0xA0, blockFnum & 0xFF);
+}
+
+void ym2612WritePan(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, uint8_t outputs)
+{
+    // B4 is the last image byte, AMS and PMS are kept
+    writeChannel(chip, channel, 0xB4, (image.data[FmRegisterImage::kSize - 1] & 0x3F) | outputs);
+}
+
+void ym2612KeyOn(VgmChip& chip, uint8_t channel)
+{
+    chip.write(0, 0x28, 0xF0 | (channel < 3 ? channel : channel + 1));
+}
+
+void ym2612KeyOff(VgmChip& chip, uint8_t channel)
+{
+    chip.write(0, 0x28, channel < 3 ? channel : channel + 1);
+}
+
+uint16_t ym2612Pitch(float note) noexcept
+{
+    const float freq = 440.0f * std::exp2((note - 69.0f) / 12.0f);
+
+    // F-number at block 0: freq * 2^21 / (clock / 144)
+    float fnum = freq * (144.0f * 2097152.0f / kYm2612Clock);
+    uint16_t block = 0;
+
+    while (fnum >= 2047.5f && block < 7)
+    {
+        fnum *= 0.5f;
+        ++block;
+    }
+
+    const int ifnum = static_cast<int>(fnum + 0.5f);
+    return static_cast<uint16_t>((block << 11) | (ifnum < 2047 ? ifnum : 2047));
+}
+
+uint8_t velocityToAttenuation(uint8_t velocity) noexcept
+{
+    return kVelocityAttenuation[velocity & 0x7F];
+}
+
+uint8_t panToOutputs(uint8_t pan) noexcept
+{
+    // bit 7 enables the left output, bit 6 the right one
+    return pan < 43 ? 0x80 : pan > 84 ? 0x40 : 0xC0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,129 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class VgmChip;
+
+// --------------------------------------------------------------------------------------------------------------------
+// YM2612 (OPN2) patch definitions
+
+static constexpr const uint32_t kYm2612Clock = 7670453; // NTSC Mega Drive
+static constexpr const uint8_t kYm2612Channels = 6;
+
+struct FmOperator {
+    uint8_t ar = 31;  // attack rate, 0-31
+    uint8_t dr = 0;   // decay rate, 0-31
+    uint8_t sr = 0;   // sustain rate, 0-31
+    uint8_t rr = 15;  // release rate, 0-15
+    uint8_t sl = 0;   // sustain level, 0-15
+    uint8_t tl = 127; // total level, 0-127
+    uint8_t ks = 0;   // key scale, 0-3
+    uint8_t ml = 1;   // multiple, 0-15
+    uint8_t dt = 0;   // detune, 0-7
+    uint8_t am = 0;   // amplitude modulation enable, 0-1
+    uint8_t ssg = 0;  // SSG-EG, 0-15
+};
+
+struct FmPatch {
+    std::string name;
+    uint8_t alg = 0; // algorithm, 0-7
+    uint8_t fb = 0;  // operator 1 feedback, 0-7
+    uint8_t ams = 0; // LFO amplitude sensitivity, 0-3
+    uint8_t pms = 0; // LFO frequency sensitivity, 0-7
+    FmOperator ops[4]; // in operator order, 1 to 4
+
+    /**
+       Bitmask of the carrier operators for the patch algorithm, bit 0 being operator 1.
+     */
+    uint8_t carrierMask() const noexcept;
+};
+
+/**
+   Channel registers of a patch, precomputed so a program change is a flat write burst.
+ */
+struct FmRegisterImage {
+    static constexpr const uint8_t kSize = 30; // 7 registers for each operator, then B0 and B4
+
+    uint8_t data[kSize];
+    uint8_t tl[4];    // operator levels, carriers get the velocity added
+    uint8_t carriers; // carrierMask() of the patch
+
+    void build(const FmPatch& patch) noexcept;
+};
+
+struct PatchBank {
+    std::string name;
+    uint16_t number = 0; // MIDI bank, MSB << 7 | LSB
+    std::vector<FmPatch> patches;
+};
+
+/**
+   All banks of a loaded file, with the register images of every bank/program pair.@n
+   Lookups are two array reads, whatever the number of banks or patches.
+ */
+struct PatchLibrary {
+    static constexpr const uint16_t kBankCount = 16384;
+    static constexpr const uint16_t kNoSlot = 0xFFFF;
+
+    std::vector<PatchBank> banks;
+    std::vector<FmRegisterImage> images; // 128 per bank, programs wrap around the bank size
+    std::vector<uint16_t> slots;         // MIDI bank number to bank index, kNoSlot if absent
+
+    /**
+       Build images and slots from @a banks, must be called after loading.
+     */
+    void prepare();
+
+    /**
+       Register image for MIDI @a bank and @a program.
+       Unknown banks fall back to the first one, an empty library to a built-in patch so the synth is never silent.
+     */
+    const FmRegisterImage& get(uint16_t bank, uint8_t program) const noexcept;
+};
+
+/**
+   Load a library from a JSON file.@n
+   The file holds a "banks" array, each bank has "msb", "lsb", "name" and a "patches" array.
+   A file with a top-level "patches" array instead is a single bank 0.@n
+   Each patch has "name", "alg", "fb", "ams", "pms"
+   and an "ops" array of 4 operators with "ar", "dr", "sr", "rr", "sl", "tl", "ks", "ml", "dt", "am" and "ssg".
+   Missing values take their defaults, values are masked to their register width.
+ */
+bool loadPatchLibrary(const char* filename, PatchLibrary& library, std::string& error);
+
+// --------------------------------------------------------------------------------------------------------------------
+// YM2612 register helpers, @a channel is 0-5
+
+void ym2612Init(VgmChip& chip);
+void ym2612WriteImage(VgmChip& chip, uint8_t channel, const FmRegisterImage& image);
+void ym2612WriteLevel(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, uint8_t attenuation);
+void ym2612WriteModulatorLevel(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, int offset);
+void ym2612WritePitch(VgmChip& chip, uint8_t channel, uint16_t blockFnum);
+void ym2612WritePan(VgmChip& chip, uint8_t channel, const FmRegisterImage& image, uint8_t outputs);
+void ym2612KeyOn(VgmChip& chip, uint8_t channel);
+void ym2612KeyOff(VgmChip& chip, uint8_t channel);
+
+/**
+   Block and F-number for a (fractional) MIDI note, packed as in registers A4/A0.
+ */
+uint16_t ym2612Pitch(float note) noexcept;
+
+/**
+   TL attenuation added to carriers for a MIDI velocity.@n
+   Also used for channel volume (CC7), General MIDI gives both the same 40dB curve.
+ */
+uint8_t velocityToAttenuation(uint8_t velocity) noexcept;
+
+/**
+   Output enable bits of register B4 for a MIDI pan value (CC10), the chip can only pan hard left, center or hard right.
+ */
+uint8_t panToOutputs(uint8_t pan) noexcept;
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,159 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+enum IncidentKind {
+    kIncidentOverrun = 0, // the audio callback took more than the threshold of its block
+    kIncidentUnderrun,    // the render-ahead worker was late, the block was played as silence
+    kIncidentKindCount
+};
+
+static inline const char* incidentKindName(uint32_t kind) noexcept
+{
+    static const char* const kNames[kIncidentKindCount] = { "overrun", "underrun" };
+    return kind < kIncidentKindCount ? kNames[kind] : "";
+}
+
+/**
+   Context of a block that missed, or came close to missing, its deadline.
+ */
+struct Incident {
+    int64_t time;      // system clock, milliseconds since the epoch
+    uint32_t kind;     // IncidentKind
+    uint32_t frames;   // host block size
+    float sampleRate;
+    float load;        // time spent in the callback over the real-time length of the block
+    uint32_t voices;   // voices allocated to a note, 0 while the render-ahead worker owns the engine
+    uint32_t chips;    // chips clocked, likewise
+    uint32_t events;   // MIDI events of the block, plus those still queued for the render-ahead worker
+    float stageShare[kProfileStageCount]; // of the profiled time of the block, profiling builds only
+};
+
+static_assert(std::is_trivially_copyable<Incident>::value && sizeof(Incident) % sizeof(uint32_t) == 0,
+              "incidents are copied through the ring a word at a time");
+
+/**
+   The last kCapacity incidents, pushed by the audio thread and read from any other.@n
+   Each slot is a seqlock: its sequence is odd while the audio thread writes it, and counts the writes to the slot.
+   Readers copy the ring without locking, and leave out the incidents overwritten while they copied.
+ */
+class IncidentLog
+{
+public:
+    static constexpr const uint32_t kCapacity = 64;
+
+    void push(const Incident& incident) noexcept
+    {
+        const uint32_t count = fCount.load(std::memory_order_relaxed);
+        Slot& slot = fSlots[count % kCapacity];
+        const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        uint32_t words[kWords];
+
+        std::memcpy(words, &incident, sizeof(Incident));
+
+        // the odd sequence is visible before any of the words
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (uint32_t w = 0; w < kWords; ++w)
+            slot.words[w].store(words[w], std::memory_order_relaxed);
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        fCount.store(count + 1, std::memory_order_release);
+    }
+
+   /**
+      Incidents recorded since the plugin was created, including those no longer in the ring.
+    */
+    uint32_t getCount() const noexcept
+    {
+        return fCount.load(std::memory_order_acquire);
+    }
+
+   /**
+      Copy the newest incident to @a incident, and return the count of incidents it was the last of, 0 if none.@n
+      Lock-free and bounded, the incident is never torn, for output parameters read from any thread.
+    */
+    uint32_t readLatest(Incident& incident) const noexcept
+    {
+        // the newest slot is only rewritten kCapacity pushes later, a retry is already unlikely
+        for (uint32_t retry = 0; retry < 4; ++retry)
+        {
+            const uint32_t count = fCount.load(std::memory_order_acquire);
+
+            if (count == 0)
+                return 0;
+
+            if (readSlot(fSlots[(count - 1) % kCapacity], 2 * ((count - 1) / kCapacity + 1), incident))
+                return count;
+        }
+
+        return 0;
+    }
+
+   /**
+      Copy the incidents still in the ring to @a incidents, oldest first, and return how many there are.@n
+      Incidents being written or overwritten during the copy are left out.
+    */
+    uint32_t read(Incident incidents[kCapacity]) const noexcept
+    {
+        const uint32_t count = fCount.load(std::memory_order_acquire);
+        const uint32_t first = count - std::min(count, kCapacity);
+        uint32_t copied = 0;
+
+        for (uint32_t i = first; i < count; ++i)
+        {
+            // incident i is the write i / kCapacity + 1 to its slot
+            if (readSlot(fSlots[i % kCapacity], 2 * (i / kCapacity + 1), incidents[copied]))
+                ++copied;
+        }
+
+        return copied;
+    }
+
+private:
+    static constexpr const uint32_t kWords = sizeof(Incident) / sizeof(uint32_t);
+
+    struct Slot {
+        std::atomic<uint32_t> sequence { 0 }; // twice the writes completed, plus one during a write
+        std::atomic<uint32_t> words[kWords] = {};
+    };
+
+    static bool readSlot(const Slot& slot, uint32_t sequence, Incident& incident) noexcept
+    {
+        if (slot.sequence.load(std::memory_order_acquire) != sequence)
+            return false;
+
+        uint32_t words[kWords];
+
+        for (uint32_t w = 0; w < kWords; ++w)
+            words[w] = slot.words[w].load(std::memory_order_relaxed);
+
+        // the words were read before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            return false;
+
+        std::memcpy(&incident, words, sizeof(Incident));
+        return true;
+    }
+
+    Slot fSlots[kCapacity];
+    std::atomic<uint32_t> fCount { 0 };
+};
+
+// --------------------------------------------------------------------------------------------------------------------
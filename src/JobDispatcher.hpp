@@ -0,0 +1,29 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Runs a batch of independent jobs, possibly in parallel, and returns once all of them are done.@n
+   Called from the thread rendering the engine, implementations must be realtime-safe.
+ */
+class JobDispatcher
+{
+public:
+    typedef void (*Function)(void* context, uint32_t index);
+
+    virtual ~JobDispatcher() {}
+
+   /**
+      Call @a function with @a context for every index from 0 to @a count, in any order and on any thread.
+    */
+    virtual void dispatch(Function function, void* context, uint32_t count) noexcept = 0;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
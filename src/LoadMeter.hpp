@@ -0,0 +1,77 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   DSP load of the audio callback, the time spent processing a block over the real-time length of that block.@n
+   Keeps an average over about kAverageTime and a peak falling back over kPeakFallTime, 1 is a full budget.@n
+   process() belongs to the audio thread, the average and peak may be read from any other.
+ */
+class LoadMeter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr const float kAverageTime = 0.300f; // seconds
+    static constexpr const float kPeakFallTime = 1.0f;  // seconds
+
+    void setSampleRate(double sampleRate) noexcept
+    {
+        fSampleRate = sampleRate;
+    }
+
+    void reset() noexcept
+    {
+        fAverage.store(0.0f, std::memory_order_relaxed);
+        fPeak.store(0.0f, std::memory_order_relaxed);
+    }
+
+   /**
+      Account for a block of @a frames frames processed from @a start to now, returns the load of that block.
+    */
+    float process(Clock::time_point start, uint32_t frames) noexcept
+    {
+        if (frames == 0)
+            return 0.0f;
+
+        const double budget = frames / fSampleRate;
+        const float load = static_cast<float>(std::chrono::duration<double>(Clock::now() - start).count() / budget);
+
+        const float average = fAverage.load(std::memory_order_relaxed);
+        const float peak = fPeak.load(std::memory_order_relaxed);
+
+        fAverage.store(average + (load - average) * static_cast<float>(1.0 - std::exp(-budget / kAverageTime)),
+                       std::memory_order_relaxed);
+        fPeak.store(std::max(load, peak * static_cast<float>(std::exp(-budget / kPeakFallTime))),
+                    std::memory_order_relaxed);
+        return load;
+    }
+
+    float getAverage() const noexcept
+    {
+        return fAverage.load(std::memory_order_relaxed);
+    }
+
+    float getPeak() const noexcept
+    {
+        return fPeak.load(std::memory_order_relaxed);
+    }
+
+private:
+    double fSampleRate = 44100.0;
+    std::atomic<float> fAverage { 0.0f };
+    std::atomic<float> fPeak { 0.0f };
+};
+
+// --------------------------------------------------------------------------------------------------------------------
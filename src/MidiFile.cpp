@@ -0,0 +1,262 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "MidiFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+struct TickEvent {
+    uint64_t tick;
+    uint8_t size;
+    uint8_t data[3];
+};
+
+struct TempoChange {
+    uint64_t tick;
+    uint32_t usPerQuarter;
+};
+
+class Reader
+{
+public:
+    Reader(const std::vector<uint8_t>& data, size_t pos, size_t end)
+        : fData(data),
+          fPos(pos),
+          fEnd(end) {}
+
+    bool atEnd() const noexcept
+    {
+        return fPos >= fEnd;
+    }
+
+    size_t tell() const noexcept
+    {
+        return fPos;
+    }
+
+    uint8_t u8()
+    {
+        if (fPos >= fEnd)
+            throw std::runtime_error("unexpected end of data");
+        return fData[fPos++];
+    }
+
+    uint32_t be(uint32_t bytes)
+    {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < bytes; ++i)
+            value = value << 8 | u8();
+        return value;
+    }
+
+    uint32_t varLen()
+    {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            const uint8_t b = u8();
+            value = value << 7 | (b & 0x7F);
+            if ((b & 0x80) == 0)
+                return value;
+        }
+        throw std::runtime_error("invalid variable-length quantity");
+    }
+
+    void skip(size_t bytes)
+    {
+        if (bytes > fEnd - fPos)
+            throw std::runtime_error("unexpected end of data");
+        fPos += bytes;
+    }
+
+private:
+    const std::vector<uint8_t>& fData;
+    size_t fPos;
+    const size_t fEnd;
+};
+
+static uint8_t channelMessageSize(uint8_t status) noexcept
+{
+    switch (status & 0xF0) {
+      case 0xC0:
+      case 0xD0:
+        return 2;
+      default:
+        return 3;
+    }
+}
+
+static void readTrack(Reader& reader, std::vector<TickEvent>& events, std::vector<TempoChange>& tempos)
+{
+    uint64_t tick = 0;
+    uint8_t running = 0;
+
+    while (! reader.atEnd())
+    {
+        tick += reader.varLen();
+
+        uint8_t status = reader.u8();
+
+        if (status == 0xFF)
+        {
+            const uint8_t type = reader.u8();
+            const uint32_t length = reader.varLen();
+
+            if (type == 0x2F)
+                return;
+
+            if (type == 0x51 && length == 3)
+                tempos.push_back({ tick, reader.be(3) });
+            else
+                reader.skip(length);
+            continue;
+        }
+
+        if (status == 0xF0 || status == 0xF7)
+        {
+            reader.skip(reader.varLen());
+            continue;
+        }
+
+        TickEvent event = {};
+        event.tick = tick;
+
+        // running status, the byte read is the first data byte
+        if (status < 0x80)
+        {
+            if (running == 0)
+                throw std::runtime_error("data byte without status");
+
+            event.data[1] = status;
+            status = running;
+            event.size = channelMessageSize(status);
+            event.data[0] = status;
+
+            if (event.size > 2)
+                event.data[2] = reader.u8();
+        }
+        else
+        {
+            running = status;
+            event.size = channelMessageSize(status);
+            event.data[0] = status;
+
+            for (uint8_t i = 1; i < event.size; ++i)
+                event.data[i] = reader.u8();
+        }
+
+        events.push_back(event);
+    }
+}
+
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+bool loadMidiFile(const char* filename, double sampleRate, std::vector<TimedMidiEvent>& events, std::string& error)
+{
+    try {
+        std::ifstream file(filename, std::ios::binary);
+        if (! file.is_open())
+        {
+            error = "cannot open file";
+            return false;
+        }
+
+        const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Reader header(data, 0, data.size());
+
+        if (header.be(4) != 0x4D546864) // "MThd"
+            throw std::runtime_error("not a Standard MIDI File");
+
+        const uint32_t headerLength = header.be(4);
+
+        if (headerLength < 6)
+            throw std::runtime_error("invalid header");
+
+        const uint16_t format = header.be(2);
+        const uint16_t tracks = header.be(2);
+        const uint16_t division = header.be(2);
+
+        if (format > 1)
+            throw std::runtime_error("only format 0 and 1 files are supported");
+        if (division == 0)
+            throw std::runtime_error("invalid time division");
+
+        std::vector<TickEvent> tickEvents;
+        std::vector<TempoChange> tempos;
+        size_t pos = 8 + static_cast<size_t>(headerLength);
+
+        for (uint16_t t = 0; t < tracks && pos + 8 <= data.size();)
+        {
+            Reader chunk(data, pos, data.size());
+            const uint32_t id = chunk.be(4);
+            const uint32_t length = chunk.be(4);
+
+            if (length > data.size() - chunk.tell())
+                throw std::runtime_error("truncated track");
+
+            // unknown chunks are skipped and do not count as tracks
+            if (id == 0x4D54726B) // "MTrk"
+            {
+                Reader track(data, chunk.tell(), chunk.tell() + length);
+                readTrack(track, tickEvents, tempos);
+                ++t;
+            }
+
+            pos = chunk.tell() + length;
+        }
+
+        // tracks are merged in time, events at the same tick keep the track order
+        std::stable_sort(tickEvents.begin(), tickEvents.end(),
+                         [](const TickEvent& a, const TickEvent& b) { return a.tick < b.tick; });
+        std::stable_sort(tempos.begin(), tempos.end(),
+                         [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+
+        const bool smpte = (division & 0x8000) != 0;
+        const double smpteTick = smpte ? 1.0 / ((-static_cast<int8_t>(division >> 8)) * (division & 0xFF)) : 0.0;
+
+        // seconds at the last tempo change, and per tick from there
+        uint64_t tempoTick = 0;
+        double tempoTime = 0.0;
+        double tickTime = smpte ? smpteTick : 0.5 / division; // 120 bpm until the first tempo change
+        size_t nextTempo = 0;
+
+        events.clear();
+        events.reserve(tickEvents.size());
+
+        for (const TickEvent& event : tickEvents)
+        {
+            while (! smpte && nextTempo < tempos.size() && tempos[nextTempo].tick <= event.tick)
+            {
+                tempoTime += (tempos[nextTempo].tick - tempoTick) * tickTime;
+                tempoTick = tempos[nextTempo].tick;
+                tickTime = tempos[nextTempo].usPerQuarter * 1e-6 / division;
+                ++nextTempo;
+            }
+
+            const double seconds = tempoTime + (event.tick - tempoTick) * tickTime;
+
+            TimedMidiEvent timed;
+            timed.frame = static_cast<uint64_t>(std::llround(seconds * sampleRate));
+            timed.size = event.size;
+            std::copy(event.data, event.data + 3, timed.data);
+            events.push_back(timed);
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+
+    return true;
+}
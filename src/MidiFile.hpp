@@ -0,0 +1,30 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Channel message of a Standard MIDI File, at its frame from the start of the song.
+ */
+struct TimedMidiEvent {
+    uint64_t frame;
+    uint8_t size;
+    uint8_t data[3];
+};
+
+/**
+   Load the channel messages of all tracks of a Standard MIDI File (format 0 or 1), sorted by time.@n
+   Tempo changes are followed, system exclusive and meta events other than tempo are skipped.
+   Returns false and fills @a error if the file can't be read.
+ */
+bool loadMidiFile(const char* filename, double sampleRate, std::vector<TimedMidiEvent>& events, std::string& error);
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,30 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// --------------------------------------------------------------------------------------------------------------------
+// Console output stage models, shared between DSP and UI
+
+/**
+   Approximations of console analog output stages, applied after the chips.
+ */
+enum OutputModel {
+    kOutputModelOff = 0,
+    kOutputModelMegaDrive1,    // Mega Drive / Genesis model 1, dark low-pass
+    kOutputModelMegaDrive2,    // Mega Drive / Genesis model 2, brighter
+    kOutputModelMasterSystem,  // Master System with the FM unit
+    kOutputModelCount
+};
+
+static inline const char* outputModelName(uint32_t model) noexcept
+{
+    static const char* const names[kOutputModelCount] = { "Off", "Mega Drive 1", "Mega Drive 2", "Master System" };
+    return model < kOutputModelCount ? names[model] : names[kOutputModelOff];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
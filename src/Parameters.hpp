@@ -0,0 +1,40 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "OutputModel.hpp"
+#include "Profiler.hpp"
+#include "Routing.hpp"
+
+// --------------------------------------------------------------------------------------------------------------------
+// Parameter indices, shared between DSP and UI
+
+enum Parameters {
+    kParamGain = 0,
+    kParamVoice,
+    kParamMultiTimbral,
+    kParamMpe,
+    kParamChipGain,                           // one per chip, in dB
+    kParamChipPan = kParamChipGain + kMaxChips, // one per chip, -1 to 1
+    kParamOutputModel = kParamChipPan + kMaxChips,
+    kParamDspLoad,                            // output, in percent of the block duration
+    kParamDspPeak,                            // output, in percent of the block duration
+    kParamIncidentKind,                       // output, IncidentKind of the last incident
+    kParamIncidentFrames,                     // output, its block size
+    kParamIncidentLoad,                       // output, in percent of the block duration
+    kParamIncidentVoices,                     // output
+    kParamIncidentChips,                      // output
+    kParamIncidentEvents,                     // output
+    kParamIncidentCount,                      // output, after the fields so a new count comes with its incident
+#ifdef VGM_PROFILING
+    kParamProfile,                            // output, one per ProfileStage, in percent of the profiled time
+    kParamCount = kParamProfile + kProfileStageCount
+#else
+    kParamCount
+#endif
+};
+
+// --------------------------------------------------------------------------------------------------------------------
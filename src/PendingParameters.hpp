@@ -0,0 +1,74 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Latest value of each of @a kCount parameters, set from any thread and applied by the thread rendering the engine
+   at the start of its next block.@n
+   Only the last value set between two blocks is applied, parameters are set rather than stepped through.
+   set() and apply() are lock-free and may be called concurrently, apply() from one thread at a time.
+ */
+template <uint32_t kCount>
+class PendingParameters
+{
+public:
+    void set(uint32_t index, float value) noexcept
+    {
+        if (index >= kCount)
+            return;
+
+        fValues[index].store(value, std::memory_order_relaxed);
+        fDirty[index / 32].fetch_or(1u << (index % 32), std::memory_order_release);
+    }
+
+   /**
+      Call @a function with the index and value of each parameter set since the last call.@n
+      A value set during the call is either applied now or left pending for the next one, never lost.
+    */
+    template <class Function>
+    void apply(Function&& function) noexcept
+    {
+        for (uint32_t w = 0; w < kWords; ++w)
+        {
+            if (fDirty[w].load(std::memory_order_relaxed) == 0)
+                continue;
+
+            for (uint32_t dirty = fDirty[w].exchange(0, std::memory_order_acquire); dirty != 0; dirty &= dirty - 1)
+            {
+                const uint32_t index = w * 32 + lowestBit(dirty);
+                function(index, fValues[index].load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+private:
+    static constexpr const uint32_t kWords = (kCount + 31) / 32;
+
+    static uint32_t lowestBit(uint32_t mask) noexcept
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+    }
+
+    std::atomic<float> fValues[kCount] = {};
+    std::atomic<uint32_t> fDirty[kWords] = {};
+};
+
+// --------------------------------------------------------------------------------------------------------------------
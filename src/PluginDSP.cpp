@@ -6,10 +6,24 @@
  */
 
 #include "DistrhoPlugin.hpp"
-#include "extra/ValueSmoother.hpp"
+#include "extra/Mutex.hpp"
+#include "extra/Thread.hpp"
 
 #include "DistrhoPluginUtils.hpp"
 
+#include "DspKernels.hpp"
+#include "IncidentLog.hpp"
+#include "LoadMeter.hpp"
+#include "Parameters.hpp"
+#include "PendingParameters.hpp"
+#include "RealtimeCheck.hpp"
+#include "RenderAhead.hpp"
+#include "SynthEngine.hpp"
+#include "Tracer.hpp"
+#include "WorkerPool.hpp"
+
+#include <chrono>
+#include <fstream>
 #include <string>
 #include <list>
 #include <iostream>
@@ -24,6 +38,12 @@ START_NAMESPACE_DISTRHO
 
 // --------------------------------------------------------------------------------------------------------------------
 
+#ifdef VGM_MULTI_OUT
+// render() hands the engine one stereo output per chip of the pool, after the main mix
+static_assert(DISTRHO_PLUGIN_NUM_OUTPUTS == 2 + 2 * kMaxChips, "DISTRHO_PLUGIN_NUM_OUTPUTS must follow kMaxChips");
+#endif
+
+
 static constexpr const float CLAMP(float v, float min, float max)
 {
     return std::min(max, std::max(min, v));
@@ -34,19 +54,212 @@ static constexpr const float DB_CO(float g)
     return g > -90.f ? std::pow(10.f, g * 0.05f) : 0.f;
 }
 
+#ifdef VGM_PROFILING
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Prints the stage counters of an instance every second, started when VGM_PROFILE_DUMP is set in the environment.
+ */
+class ProfileDumper : public Thread
+{
+public:
+    ProfileDumper(const ProfileStats& stats)
+        : Thread("ProfileDumper"),
+          fStats(stats) {}
+
+protected:
+    void run() override
+    {
+        uint64_t lastTicks[kProfileStageCount] = {};
+        uint64_t lastCalls[kProfileStageCount] = {};
+
+        while (! shouldThreadExit())
+        {
+            d_msleep(1000);
+
+            uint64_t ticks[kProfileStageCount], calls[kProfileStageCount], total = 0;
+
+            for (uint32_t s = 0; s < kProfileStageCount; ++s)
+            {
+                ticks[s] = fStats.ticks[s].load(std::memory_order_relaxed) - lastTicks[s];
+                calls[s] = fStats.calls[s].load(std::memory_order_relaxed) - lastCalls[s];
+                lastTicks[s] += ticks[s];
+                lastCalls[s] += calls[s];
+                total += ticks[s];
+            }
+
+            for (uint32_t s = 0; s < kProfileStageCount && total != 0; ++s)
+                d_stdout("%-8s %5.1f%% %10llu calls %10.0f ticks/call", profileStageName(s), 100.0 * ticks[s] / total,
+                         static_cast<unsigned long long>(calls[s]), calls[s] != 0 ? double(ticks[s]) / calls[s] : 0.0);
+        }
+    }
+
+private:
+    const ProfileStats& fStats;
+};
+
+#endif
+
+#ifdef VGM_TRACING
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Collects the spans of every thread of the process while an instance exists, and writes them as Chrome trace JSON
+   when the last instance is deleted.@n
+   Started by the first instance when VGM_TRACE_FILE names the file in the environment.
+ */
+class TraceWriter : public Thread
+{
+public:
+    static void acquire()
+    {
+        const MutexLocker cml(sMutex);
+
+        if (sUsers++ != 0)
+            return;
+
+        const char* const filename = std::getenv("VGM_TRACE_FILE");
+
+        if (filename != nullptr && filename[0] != '\0')
+        {
+            sWriter = new TraceWriter(filename);
+            sWriter->startThread();
+        }
+    }
+
+    static void release()
+    {
+        const MutexLocker cml(sMutex);
+
+        if (--sUsers == 0 && sWriter != nullptr)
+        {
+            delete sWriter;
+            sWriter = nullptr;
+        }
+    }
+
+protected:
+    void run() override
+    {
+        // often enough for the thread buffers at any sample rate and buffer size
+        while (! shouldThreadExit())
+        {
+            fRecorder.collect();
+            d_msleep(50);
+        }
+    }
+
+private:
+    explicit TraceWriter(const char* filename)
+        : Thread("TraceWriter"),
+          fFilename(filename) {}
+
+    ~TraceWriter() override
+    {
+        stopThread(2000);
+        fRecorder.collect();
+
+        std::string error;
+
+        if (fRecorder.writeChromeTrace(fFilename.c_str(), error))
+            d_stdout("Wrote %zu trace spans to %s", fRecorder.getSpanCount(), fFilename.c_str());
+        else
+            d_stderr("Failed to write trace %s: %s", fFilename.c_str(), error.c_str());
+    }
+
+    const std::string fFilename;
+    TraceRecorder fRecorder;
+
+    static Mutex sMutex;
+    static TraceWriter* sWriter;
+    static uint32_t sUsers;
+};
+
+Mutex TraceWriter::sMutex;
+TraceWriter* TraceWriter::sWriter = nullptr;
+uint32_t TraceWriter::sUsers = 0;
+
+#endif
 // --------------------------------------------------------------------------------------------------------------------
 
-class ImGuiPluginDSP : public Plugin
+class ImGuiPluginDSP : public Plugin,
+                       private RenderAhead::Client
 {
-    enum Parameters {
-        kParamGain = 0,
-        kParamVoice,
-        kParamCount
+    static constexpr const uint32_t kProgramCount = 128;
+    static constexpr const uint32_t kMaxRenderAheadTime = 200; // ms
+    static constexpr const uint32_t kIncidentCountWrap = 10000;
+
+    // one port group per chip bus of the multi-out build, predefined groups are at the top of the range
+    static constexpr const uint32_t kPortGroupChip = 0;
+
+    enum States {
+        kStateFile = 0,
+        kStateRouting,
+        kStateRenderAhead,
+        kStateRenderThreads,
+        kStateIncidentThreshold,
+        kStateIncidentLog,
+        kStateCount
     };
 
     float fGainDB = 0.0f;
+    std::atomic<float> fGain { 1.0f }; // linear, picked up by the audio thread at the start of each block
     int fVoice = 0;
-    ExponentialValueSmoother fSmoothGain;
+    bool fMultiTimbral = false;
+    bool fMpe = false;
+    float fChipGainDB[kMaxChips] = {};
+    float fChipPan[kMaxChips] = {};
+    int fOutputModel = kOutputModelOff;
+    GainSmoother fSmoothGain;
+    float fGainRamp[SynthEngine::kMaxRenderFrames];
+    LoadMeter fLoadMeter;
+
+    // held by whatever renders the engine, run() or the render-ahead worker,
+    // and by setState() while it swaps the library or routing
+    Mutex fMutex;
+    SynthEngine fEngine;
+
+    // engine parameters set by the host from any thread, applied by the thread rendering the engine,
+    // run() or the render-ahead worker
+    PendingParameters<kParamCount> fPendingParameters;
+
+    // chip mix as last given to the engine, on the thread rendering it
+    float fEngineChipGain[kMaxChips] = {};
+    float fEngineChipPan[kMaxChips] = {};
+
+    // opt-in, the engine runs on a worker thread this many milliseconds behind, applied on activate()
+    std::atomic<uint32_t> fRenderAheadTime { 0 };
+    RenderAhead fRenderAhead;
+
+    // opt-in, threads the chips of each quantum are spread over, including the rendering one, applied on activate()
+    std::atomic<uint32_t> fRenderThreads { 1 };
+    WorkerPool fWorkerPool;
+
+    // blocks that took more than the threshold of their duration, or that the render-ahead worker was late for
+    std::atomic<float> fIncidentThreshold { 0.9f };
+    IncidentLog fIncidentLog; // the newest incident is reported as output parameters
+    uint32_t fLastUnderruns = 0;
+    uint32_t fEngineVoices = 0;  // after the last block the audio thread rendered
+    uint32_t fEngineChips = 0;
+#ifdef VGM_PROFILING
+    uint64_t fIncidentProfileLast[kProfileStageCount] = {};
+#endif
+
+#ifdef VGM_PROFILING
+    // share of each stage over the last kProfileWindow seconds, from the engine counters
+    static constexpr const float kProfileWindow = 0.250f;
+    uint64_t fProfileLast[kProfileStageCount] = {};
+    std::atomic<float> fProfileShare[kProfileStageCount] = {}; // read by getParameterValue() from any thread
+    uint32_t fProfileFrames = 0;
+    ProfileDumper fProfileDumper;
+#endif
+
+    // last values given to setState(), for getState()
+    String fFileState;
+    String fRoutingState;
+    String fRenderAheadState;
+    String fRenderThreadsState;
+    String fIncidentThresholdState;
 
 public:
    /**
@@ -54,14 +267,44 @@ public:
       You must set all parameter values to their defaults, matching ParameterRanges::def.
     */
     ImGuiPluginDSP()
-        : Plugin(kParamCount, 0, 1) // parameters, programs, states
+        : Plugin(kParamCount, kProgramCount, kStateCount), // parameters, programs, states
+          fRenderAhead(fEngine, fMutex, *this)
+#ifdef VGM_PROFILING
+        , fProfileDumper(fEngine.getProfileStats())
+#endif
     {
+        fEngine.setSampleRate(getSampleRate());
+
         fSmoothGain.setSampleRate(getSampleRate());
         fSmoothGain.setTargetValue(DB_CO(0.f));
         fSmoothGain.setTimeConstant(0.020f); // 20ms
 
+        fLoadMeter.setSampleRate(getSampleRate());
+
+        for (uint32_t c = 0; c < kMaxChips; ++c)
+            fEngineChipGain[c] = DB_CO(0.f);
+
+#ifdef VGM_PROFILING
+        if (std::getenv("VGM_PROFILE_DUMP") != nullptr)
+            fProfileDumper.startThread();
+#endif
+
+#ifdef VGM_TRACING
+        TraceWriter::acquire();
+#endif
+
         // res = fs::path(getBinaryFilename()).parent_path().parent_path();
     }
+
+    ~ImGuiPluginDSP() override
+    {
+#ifdef VGM_PROFILING
+        fProfileDumper.stopThread(2000);
+#endif
+#ifdef VGM_TRACING
+        TraceWriter::release();
+#endif
+    }
     
 
 protected:
@@ -80,7 +323,7 @@ protected:
     void initParameter(uint32_t index, Parameter& parameter) override
     {
         switch (index) {
-          case 0:
+          case kParamGain:
             parameter.ranges.min = -90.0f;
             parameter.ranges.max = 30.0f;
             parameter.ranges.def = 0.0f;
@@ -90,7 +333,7 @@ protected:
             parameter.symbol = "gain";
             parameter.unit = "dB";
             break;
-          case 1:
+          case kParamVoice:
             parameter.ranges.min = 0;
             parameter.ranges.max = 128;
             parameter.ranges.def = 0;
@@ -99,7 +342,229 @@ protected:
             parameter.shortName = "Voice";
             parameter.symbol = "voice";
             break;
+          case kParamMultiTimbral:
+            parameter.ranges.min = 0;
+            parameter.ranges.max = 1;
+            parameter.ranges.def = 0;
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean;
+            parameter.name = "Multi-timbral";
+            parameter.shortName = "Multi";
+            parameter.symbol = "multitimbral";
+            break;
+          case kParamMpe:
+            parameter.ranges.min = 0;
+            parameter.ranges.max = 1;
+            parameter.ranges.def = 0;
+            parameter.hints = kParameterIsAutomatable|kParameterIsBoolean;
+            parameter.name = "MPE";
+            parameter.shortName = "MPE";
+            parameter.symbol = "mpe";
+            break;
+          case kParamOutputModel:
+            parameter.ranges.min = 0;
+            parameter.ranges.max = kOutputModelCount - 1;
+            parameter.ranges.def = kOutputModelOff;
+            parameter.hints = kParameterIsAutomatable|kParameterIsInteger;
+            parameter.name = "Output model";
+            parameter.shortName = "Model";
+            parameter.symbol = "outputmodel";
+            parameter.enumValues.count = kOutputModelCount;
+            parameter.enumValues.restrictedMode = true;
+            {
+                ParameterEnumerationValue* const values = new ParameterEnumerationValue[kOutputModelCount];
+
+                for (uint32_t i = 0; i < kOutputModelCount; ++i)
+                {
+                    values[i].value = i;
+                    values[i].label = outputModelName(i);
+                }
+
+                parameter.enumValues.values = values;
+            }
+            break;
+          case kParamDspLoad:
+          case kParamDspPeak:
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = 200.0f;
+            parameter.ranges.def = 0.0f;
+            parameter.hints = kParameterIsOutput;
+            parameter.name = index == kParamDspLoad ? "DSP load" : "DSP peak";
+            parameter.shortName = index == kParamDspLoad ? "Load" : "Peak";
+            parameter.symbol = index == kParamDspLoad ? "dspload" : "dsppeak";
+            parameter.unit = "%";
+            break;
+          case kParamIncidentKind:
+          case kParamIncidentFrames:
+          case kParamIncidentLoad:
+          case kParamIncidentVoices:
+          case kParamIncidentChips:
+          case kParamIncidentEvents:
+          case kParamIncidentCount:
+            initIncidentParameter(index, parameter);
+            break;
+          default:
+#ifdef VGM_PROFILING
+            if (index >= kParamProfile)
+            {
+                initProfileParameter(index, parameter);
+                break;
+            }
+#endif
+            initChipParameter(index, parameter);
+            break;
+        }
+    }
+
+   /**
+      Gain and pan of each chip of the pool, numbered from 1.
+    */
+    void initChipParameter(uint32_t index, Parameter& parameter)
+    {
+        const bool gain = index < kParamChipPan;
+        const uint32_t chip = (gain ? index - kParamChipGain : index - kParamChipPan) + 1;
+        char name[32];
+
+        if (gain)
+        {
+            parameter.ranges.min = -90.0f;
+            parameter.ranges.max = 12.0f;
+            parameter.ranges.def = 0.0f;
+            parameter.unit = "dB";
         }
+        else
+        {
+            parameter.ranges.min = -1.0f;
+            parameter.ranges.max = 1.0f;
+            parameter.ranges.def = 0.0f;
+        }
+
+        parameter.hints = kParameterIsAutomatable;
+
+        std::snprintf(name, sizeof(name), gain ? "Chip %u Gain" : "Chip %u Pan", chip);
+        parameter.name = name;
+        std::snprintf(name, sizeof(name), gain ? "Gain %u" : "Pan %u", chip);
+        parameter.shortName = name;
+        std::snprintf(name, sizeof(name), gain ? "chip%ugain" : "chip%upan", chip);
+        parameter.symbol = name;
+    }
+
+   /**
+      Context of the last incident, with the number of incidents so far once the other fields are set.
+    */
+    void initIncidentParameter(uint32_t index, Parameter& parameter)
+    {
+        static const struct {
+            const char* name;
+            const char* symbol;
+            float max;
+        } kIncidentParameters[] = {
+            { "Incident Kind", "incidentkind", kIncidentKindCount - 1 },
+            { "Incident Frames", "incidentframes", 8192.0f },
+            { "Incident Load", "incidentload", 1000.0f },
+            { "Incident Voices", "incidentvoices", kMaxVoices },
+            { "Incident Chips", "incidentchips", kMaxChips },
+            { "Incident Events", "incidentevents", 4096.0f },
+            { "Incidents", "incidentcount", kIncidentCountWrap - 1 },
+        };
+        const auto& p = kIncidentParameters[index - kParamIncidentKind];
+
+        parameter.ranges.min = 0.0f;
+        parameter.ranges.max = p.max;
+        parameter.ranges.def = 0.0f;
+        parameter.hints = index == kParamIncidentLoad ? kParameterIsOutput : kParameterIsOutput|kParameterIsInteger;
+        parameter.name = p.name;
+        parameter.shortName = p.name;
+        parameter.symbol = p.symbol;
+
+        if (index == kParamIncidentLoad)
+            parameter.unit = "%";
+    }
+
+#ifdef VGM_PROFILING
+   /**
+      Share of the profiled time spent in each stage, over the last kProfileWindow.
+    */
+    void initProfileParameter(uint32_t index, Parameter& parameter)
+    {
+        const char* const stage = profileStageName(index - kParamProfile);
+        char name[32];
+
+        parameter.ranges.min = 0.0f;
+        parameter.ranges.max = 100.0f;
+        parameter.ranges.def = 0.0f;
+        parameter.hints = kParameterIsOutput;
+        parameter.unit = "%";
+
+        std::snprintf(name, sizeof(name), "Profile %s", stage);
+        parameter.name = name;
+        parameter.shortName = stage;
+        std::snprintf(name, sizeof(name), "profile%u", index - kParamProfile);
+        parameter.symbol = name;
+    }
+#endif
+
+#ifdef VGM_MULTI_OUT
+   /**
+      The main mix comes first, then a stereo bus per chip of the pool, after the chip gain and pan.
+    */
+    void initAudioPort(bool input, uint32_t index, AudioPort& port) override
+    {
+        if (input)
+        {
+            Plugin::initAudioPort(input, index, port);
+            return;
+        }
+
+        const bool left = index % 2 == 0;
+        char name[32];
+
+        port.hints = 0x0;
+
+        if (index < 2)
+        {
+            port.groupId = kPortGroupStereo;
+            port.name = left ? "Left" : "Right";
+            port.symbol = left ? "out_left" : "out_right";
+            return;
+        }
+
+        const uint32_t chip = index / 2 - 1;
+        port.groupId = kPortGroupChip + chip;
+
+        std::snprintf(name, sizeof(name), left ? "Chip %u Left" : "Chip %u Right", chip + 1);
+        port.name = name;
+        std::snprintf(name, sizeof(name), left ? "chip%u_left" : "chip%u_right", chip + 1);
+        port.symbol = name;
+    }
+
+    void initPortGroup(uint32_t groupId, PortGroup& portGroup) override
+    {
+        char name[32];
+
+        std::snprintf(name, sizeof(name), "Chip %u", groupId - kPortGroupChip + 1);
+        portGroup.name = name;
+        std::snprintf(name, sizeof(name), "chip%u", groupId - kPortGroupChip + 1);
+        portGroup.symbol = name;
+    }
+#endif
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // Programs
+
+   /**
+      Programs map to the programs of the first bank of the loaded file, like the Voice parameter.
+    */
+    void initProgramName(uint32_t index, String& programName) override
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "Program %u", index + 1);
+        programName = name;
+    }
+
+    void loadProgram(uint32_t index) override
+    {
+        fVoice = int(index);
+        sendParameter(kParamVoice, index);
     }
 
     // ----------------------------------------------------------------------------------------------------------------
@@ -113,20 +578,132 @@ protected:
     void initState(uint32_t index, State& state) override
     {
       // std::cout << "initState " << index << '\n';
-      if (index == 0)
+      if (index == kStateFile)
       {
         state.key = "file";
         state.defaultValue = "";
         state.hints = kStateIsFilenamePath;
       }
+      else if (index == kStateRouting)
+      {
+        state.key = "routing";
+        state.defaultValue = "";
+        state.hints = 0x0;
+      }
+      else if (index == kStateRenderAhead)
+      {
+        state.key = "renderahead";
+        state.defaultValue = "0";
+        state.hints = 0x0;
+      }
+      else if (index == kStateRenderThreads)
+      {
+        state.key = "renderthreads";
+        state.defaultValue = "1";
+        state.hints = 0x0;
+      }
+      else if (index == kStateIncidentThreshold)
+      {
+        state.key = "incidentthreshold";
+        state.defaultValue = "90";
+        state.hints = 0x0;
+      }
+      else if (index == kStateIncidentLog)
+      {
+        state.key = "incidentlog";
+        state.defaultValue = "";
+        state.hints = 0x0;
+      }
     }
     
     void setState(const char* key, const char* value) override
     {
       if (std::strcmp(key, "file") == 0)
       {
+        VGM_TRACE_SCOPE("Load bank");
+        PatchLibrary library;
+        std::string error;
+
+        // parsing and register images are done here, never on the audio thread
+        if (value[0] != '\0' && ! loadPatchLibrary(value, library, error))
+        {
+          d_stderr("Failed to load bank %s: %s", value, error.c_str());
+          return;
+        }
+
+        fFileState = value;
+
+        // the previous library is swapped out and freed when leaving this scope, after the lock
+        const MutexLocker cml(fMutex);
+        fEngine.allNotesOff();
+        fEngine.setLibrary(library);
+      }
+      else if (std::strcmp(key, "routing") == 0)
+      {
+        VGM_TRACE_SCOPE("Load routing");
+        ChannelRoute routes[kMidiChannels];
+
+        if (value[0] == '\0')
+        {
+          for (uint8_t c = 0; c < kMidiChannels; ++c)
+            routes[c] = defaultChannelRoute(c);
+        }
+        else if (! routingFromString(value, routes))
+        {
+          d_stderr("Invalid routing table: %s", value);
+          return;
+        }
+
+        fRoutingState = value;
+
+        const MutexLocker cml(fMutex);
+        fEngine.allNotesOff();
+        for (uint8_t c = 0; c < kMidiChannels; ++c)
+          fEngine.setRoute(c, routes[c]);
+
+        // chips the new routing reaches for the first time are started here, off the audio thread
+        fEngine.prepareChips();
+      }
+      else if (std::strcmp(key, "renderahead") == 0)
+      {
+        // the worker and the reported latency only change on the next activation
+        fRenderAheadTime.store(std::min<uint32_t>(std::strtoul(value, nullptr, 10), kMaxRenderAheadTime));
+        fRenderAheadState = value;
+      }
+      else if (std::strcmp(key, "renderthreads") == 0)
+      {
+        // likewise, the workers are started on the next activation
+        fRenderThreads.store(CLAMP(std::strtoul(value, nullptr, 10), 1, kMaxChips));
+        fRenderThreadsState = value;
+      }
+      else if (std::strcmp(key, "incidentthreshold") == 0)
+      {
+        // in percent of the block duration, read by the audio thread after each block
+        fIncidentThreshold.store(CLAMP(std::strtof(value, nullptr), 10.0f, 1000.0f) / 100.0f);
+        fIncidentThresholdState = value;
+      }
+      else if (std::strcmp(key, "incidentlog") == 0)
+      {
+        // a request rather than a setting, getState() never returns it and an empty value does nothing
+        if (value[0] != '\0')
+          writeIncidentLog(value);
       }
     }
+
+    String getState(const char* key) const override
+    {
+      if (std::strcmp(key, "file") == 0)
+        return fFileState;
+      if (std::strcmp(key, "routing") == 0)
+        return fRoutingState;
+      if (std::strcmp(key, "renderahead") == 0)
+        return fRenderAheadState;
+      if (std::strcmp(key, "renderthreads") == 0)
+        return fRenderThreadsState;
+      if (std::strcmp(key, "incidentthreshold") == 0)
+        return fIncidentThresholdState;
+      return String();
+    }
    /**
       Get the current value of a parameter.@n
       The host may call this function from any context, including realtime processing.
@@ -134,12 +711,78 @@ protected:
     float getParameterValue(uint32_t index) const override
     {
         switch (index) {
-          case 0:
+          case kParamGain:
             return fGainDB;
             break;
-          case 1:
+          case kParamVoice:
             return fVoice;
             break;
+          case kParamMultiTimbral:
+            return fMultiTimbral ? 1.0f : 0.0f;
+            break;
+          case kParamMpe:
+            return fMpe ? 1.0f : 0.0f;
+            break;
+          case kParamOutputModel:
+            return fOutputModel;
+            break;
+          case kParamDspLoad:
+            return fLoadMeter.getAverage() * 100.0f;
+            break;
+          case kParamDspPeak:
+            return fLoadMeter.getPeak() * 100.0f;
+            break;
+          case kParamIncidentKind:
+          case kParamIncidentFrames:
+          case kParamIncidentLoad:
+          case kParamIncidentVoices:
+          case kParamIncidentChips:
+          case kParamIncidentEvents:
+            return getIncidentParameter(index);
+            break;
+          case kParamIncidentCount:
+            // the UI only looks for changes
+            return fIncidentLog.getCount() % kIncidentCountWrap;
+            break;
+          default:
+#ifdef VGM_PROFILING
+            if (index >= kParamProfile)
+                return fProfileShare[index - kParamProfile].load(std::memory_order_relaxed) * 100.0f;
+#endif
+            if (index >= kParamChipPan && index < kParamOutputModel)
+                return fChipPan[index - kParamChipPan];
+            if (index >= kParamChipGain && index < kParamChipPan)
+                return fChipGainDB[index - kParamChipGain];
+            break;
+        }
+        return 0.0f;
+    }
+
+   /**
+      A field of the newest incident, read through the seqlock of its slot, the audio thread may be pushing another.
+    */
+    float getIncidentParameter(uint32_t index) const noexcept
+    {
+        Incident incident;
+
+        if (fIncidentLog.readLatest(incident) == 0)
+            return 0.0f;
+
+        switch (index) {
+          case kParamIncidentKind:
+            return incident.kind;
+          case kParamIncidentFrames:
+            return std::min<float>(incident.frames, 8192.0f);
+          case kParamIncidentLoad:
+            return std::min(incident.load * 100.0f, 1000.0f);
+          case kParamIncidentVoices:
+            return incident.voices;
+          case kParamIncidentChips:
+            return incident.chips;
+          case kParamIncidentEvents:
+            return std::min<float>(incident.events, 4096.0f);
+          default:
+            return 0.0f;
         }
     }
 
@@ -151,17 +794,86 @@ protected:
     */
     void setParameterValue(uint32_t index, float value) override
     {
+        VGM_REALTIME_SCOPE("ImGuiPluginDSP::setParameterValue");
+
         switch (index) {
-          case 0:
+          case kParamGain:
             fGainDB = value;
-            fSmoothGain.setTargetValue(DB_CO(CLAMP(value, -90.0, 30.0)));
+            fGain.store(DB_CO(CLAMP(value, -90.0, 30.0)), std::memory_order_relaxed);
             break;
-          case 1:
+          case kParamVoice:
             fVoice = int(value);
+            sendParameter(index, value);
+            break;
+          case kParamMultiTimbral:
+            fMultiTimbral = value > 0.5f;
+            sendParameter(index, value);
+            break;
+          case kParamMpe:
+            fMpe = value > 0.5f;
+            sendParameter(index, value);
+            break;
+          case kParamOutputModel:
+            fOutputModel = int(value);
+            sendParameter(index, value);
+            break;
+          default:
+            if (index >= kParamChipPan && index < kParamOutputModel)
+                fChipPan[index - kParamChipPan] = CLAMP(value, -1.0f, 1.0f);
+            else if (index >= kParamChipGain && index < kParamChipPan)
+                fChipGainDB[index - kParamChipGain] = value;
+            else
+                break;
+
+            sendParameter(index, value);
             break;
         }
 
     }
+
+   /**
+      Engine parameters are left pending, for run() or the render-ahead worker to apply at the start of the next
+      block they render, with the engine locked.@n
+      The engine may be rendering on another thread, they are never applied here.
+    */
+    void sendParameter(uint32_t index, float value)
+    {
+        fPendingParameters.set(index, value);
+    }
+
+    void applyPendingParameters() noexcept override
+    {
+        fPendingParameters.apply([this](uint32_t index, float value) { applyParameter(index, value); });
+    }
+
+    void applyParameter(uint32_t index, float value) noexcept
+    {
+        switch (index) {
+          case kParamVoice:
+            fEngine.setProgram(static_cast<uint8_t>(CLAMP(value, 0.0f, 127.0f)));
+            break;
+          case kParamMultiTimbral:
+            fEngine.setMultiTimbral(value > 0.5f);
+            break;
+          case kParamMpe:
+            fEngine.setMpe(value > 0.5f);
+            break;
+          case kParamOutputModel:
+            fEngine.setOutputModel(static_cast<uint8_t>(CLAMP(value, 0.0f, kOutputModelCount - 1)));
+            break;
+          default:
+            if (index >= kParamChipPan && index < kParamOutputModel)
+                fEngineChipPan[index - kParamChipPan] = CLAMP(value, -1.0f, 1.0f);
+            else if (index >= kParamChipGain && index < kParamChipPan)
+                fEngineChipGain[index - kParamChipGain] = DB_CO(CLAMP(value, -90.0f, 12.0f));
+            else
+                break;
+
+            const uint32_t chip = (index - kParamChipGain) % kMaxChips;
+            fEngine.setChipMix(chip, fEngineChipGain[chip], fEngineChipPan[chip]);
+            break;
+        }
+    }
     
     // ----------------------------------------------------------------------------------------------------------------
     // Audio/MIDI Processing
@@ -171,58 +883,319 @@ protected:
     */
     void activate() override
     {
+        VGM_TRACE_SCOPE("activate");
+        fSmoothGain.setTargetValue(fGain.load(std::memory_order_relaxed));
         fSmoothGain.clearToTargetValue();
-          
+        fLoadMeter.reset();
+
+        {
+            const MutexLocker cml(fMutex);
+            fEngine.activate();
+            applyPendingParameters();
+
+            if (fWorkerPool.start(privateRenderThreads() - 1) != 0)
+                fEngine.setJobDispatcher(&fWorkerPool);
+        }
+
+        // a state change may come from another thread while activating
+        const uint32_t renderAheadTime = fRenderAheadTime.load();
+
+        if (renderAheadTime == 0)
+        {
+            setLatency(0);
+            return;
+        }
+
+        const uint32_t latency = static_cast<uint32_t>(getSampleRate() * renderAheadTime / 1000);
+        setLatency(fRenderAhead.start(latency, getBufferSize(), DISTRHO_PLUGIN_NUM_OUTPUTS));
+        fLastUnderruns = 0;
     }
-    
-#define EVENT_NOTEON 0x90
-#define EVENT_NOTEOFF 0x80
-#define EVENT_PITCHBEND 0xE0
-#define EVENT_PGMCHANGE 0xC0
-#define EVENT_CONTROLLER 0xB0
-    
-    void handleMidi(const MidiEvent* event)
-    {   
-      uint8_t b0 = event->data[0]; // status + channel
-      uint8_t b0_status = b0 & 0xF0;
-      uint8_t b0_channel = b0 & 0x0F;
-      uint8_t b1 = event->data[1]; // note
-      uint8_t b2 = event->data[2]; // velocity
-      d_stdout("MIDI in 0x%x (status: 0x%x, channel: 0x%x) %d %d", b0, b0_status, b0_channel, b1, b2);
-      
-      switch (b0_status) {
-        case EVENT_NOTEON:
-          break;
-        case EVENT_NOTEOFF:
-          break;
-        case EVENT_PITCHBEND:
-          break;
-        case EVENT_PGMCHANGE:
-          break;
-        case EVENT_CONTROLLER:
-          break;
-      }
+
+   /**
+      CLAP hosts schedule all their instances on their own thread pool, a private one per instance would only compete
+      with it. The framework does not hand over the host thread-pool extension, so CLAP instances render serially.
+    */
+    uint32_t privateRenderThreads() const
+    {
+        return std::strcmp(getPluginFormatName(), "CLAP") == 0 ? 1 : fRenderThreads.load();
     }
+
    /**
-      Run/process function for plugins without MIDI input.
+      Deactivate this plugin.
+    */
+    void deactivate() override
+    {
+        VGM_TRACE_SCOPE("deactivate");
+        fRenderAhead.stop();
+
+        const MutexLocker cml(fMutex);
+        fEngine.setJobDispatcher(nullptr);
+        fWorkerPool.stop();
+        fEngine.deactivate();
+    }
+
+   /**
+      Run/process function for plugins with MIDI input.
       @note Some parameters might be null if there are no audio inputs or outputs.
     */
     void run(const float** inputs, float** outputs, uint32_t frames, const MidiEvent* midiEvents, uint32_t midiEventCount) override
     {
-        for (size_t i = 0; i < midiEventCount; i++) {
-          handleMidi(&midiEvents[i]);
+        VGM_REALTIME_SCOPE("ImGuiPluginDSP::run");
+        VGM_TRACE_THREAD_NAME("Audio");
+        VGM_TRACE_SCOPE("run");
+
+        const LoadMeter::Clock::time_point start = LoadMeter::Clock::now();
+
+        process(outputs, frames, midiEvents, midiEventCount);
+        const float load = fLoadMeter.process(start, frames);
+
+#ifdef VGM_PROFILING
+        updateProfileShares(frames);
+#endif
+        checkDeadline(load, frames, midiEventCount);
+    }
+
+   /**
+      Log the block as an incident when it took more than the threshold of its duration,
+      or when the render-ahead worker did not have it ready.
+    */
+    void checkDeadline(float load, uint32_t frames, uint32_t midiEventCount)
+    {
+#ifdef VGM_PROFILING
+        // stage times of this block alone, the window of updateProfileShares() is far longer
+        const ProfileStats& stats = fEngine.getProfileStats();
+        uint64_t ticks[kProfileStageCount], total = 0;
+
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+        {
+            ticks[s] = stats.ticks[s].load(std::memory_order_relaxed) - fIncidentProfileLast[s];
+            fIncidentProfileLast[s] += ticks[s];
+            total += ticks[s];
+        }
+#endif
+
+        const uint32_t underruns = fRenderAhead.getUnderruns();
+        const bool underrun = underruns != fLastUnderruns;
+        fLastUnderruns = underruns;
+
+        if (! underrun && load <= fIncidentThreshold.load(std::memory_order_relaxed))
+            return;
+
+        Incident incident = {};
+        incident.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        incident.kind = underrun ? kIncidentUnderrun : kIncidentOverrun;
+        incident.frames = frames;
+        incident.sampleRate = static_cast<float>(getSampleRate());
+        incident.load = load;
+        incident.events = midiEventCount;
+
+        // the render-ahead worker owns the engine, only its queue is known here
+        if (fRenderAhead.isActive())
+        {
+            incident.events += fRenderAhead.getPendingEvents();
         }
+        else
+        {
+            incident.voices = fEngineVoices;
+            incident.chips = fEngineChips;
+        }
+
+#ifdef VGM_PROFILING
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+            incident.stageShare[s] = total != 0 ? static_cast<float>(ticks[s]) / total : 0.0f;
+#endif
+
+        fIncidentLog.push(incident);
+    }
+
+   /**
+      Write the incidents still in the log as JSON, called from setState(), never on the audio thread.
+    */
+    void writeIncidentLog(const char* filename)
+    {
+        Incident incidents[IncidentLog::kCapacity];
+        const uint32_t count = fIncidentLog.read(incidents);
+
+        json j;
+        j["total"] = fIncidentLog.getCount();
+        j["threshold"] = fIncidentThreshold.load() * 100.0f;
+        j["incidents"] = json::array();
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const Incident& incident = incidents[i];
+            json ji;
+
+            ji["time"] = incident.time;
+            ji["kind"] = incidentKindName(incident.kind);
+            ji["frames"] = incident.frames;
+            ji["sampleRate"] = incident.sampleRate;
+            ji["load"] = incident.load * 100.0f;
+            ji["voices"] = incident.voices;
+            ji["chips"] = incident.chips;
+            ji["events"] = incident.events;
+#ifdef VGM_PROFILING
+            for (uint32_t s = 0; s < kProfileStageCount; ++s)
+                ji["stages"][profileStageName(s)] = incident.stageShare[s] * 100.0f;
+#endif
+            j["incidents"].push_back(ji);
+        }
+
+        std::ofstream file(filename);
+        file << j.dump(2) << '\n';
+
+        if (! file.good())
+            d_stderr("Failed to write incidents to %s", filename);
+    }
+
+#ifdef VGM_PROFILING
+    void updateProfileShares(uint32_t frames)
+    {
+        fProfileFrames += frames;
+
+        if (fProfileFrames < getSampleRate() * kProfileWindow)
+            return;
+
+        const ProfileStats& stats = fEngine.getProfileStats();
+        uint64_t ticks[kProfileStageCount], total = 0;
+
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+        {
+            ticks[s] = stats.ticks[s].load(std::memory_order_relaxed) - fProfileLast[s];
+            fProfileLast[s] += ticks[s];
+            total += ticks[s];
+        }
+
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+            fProfileShare[s].store(total != 0 ? static_cast<float>(ticks[s]) / total : 0.0f, std::memory_order_relaxed);
+
+        fProfileFrames = 0;
+    }
+#endif
+
+   /**
+      MIDI events are applied at their frame offset, the chips are rendered in between.
+    */
+    void process(float** outputs, uint32_t frames, const MidiEvent* midiEvents, uint32_t midiEventCount)
+    {
         // get the left and right audio outputs
         float* const outL = outputs[0];
         float* const outR = outputs[1];
-        
-        // apply gain against all samples
-        for (uint32_t i=0; i < frames; ++i)
+
+        fSmoothGain.setTargetValue(fGain.load(std::memory_order_relaxed));
+
+        // the engine belongs to the worker, only hand over the events and copy what it rendered
+        if (fRenderAhead.isActive())
+        {
+            for (uint32_t i = 0; i < midiEventCount; ++i)
+            {
+                const MidiEvent& event = midiEvents[i];
+                fRenderAhead.queueMidi(std::min(event.frame, frames),
+                                       event.size > MidiEvent::kDataSize ? event.dataExt : event.data, event.size);
+            }
+
+            fRenderAhead.process(outputs, frames);
+            applyOutputGain(outL, outR, frames);
+            return;
+        }
+
+        const MutexTryLocker cmtl(fMutex);
+
+        if (cmtl.wasNotLocked())
+        {
+            clearOutputs(outputs, frames);
+            return;
+        }
+
+        // changes the lock was not available for stay pending until the next block
+        applyPendingParameters();
+
+        // silent engine and nothing to wake it, skip rendering and gain altogether
+        if (midiEventCount == 0 && fEngine.isIdle())
+        {
+            clearOutputs(outputs, frames);
+            fSmoothGain.clearToTargetValue();
+            fEngineVoices = fEngineChips = 0;
+            return;
+        }
+
+        uint32_t framesDone = 0;
+
+        for (uint32_t i = 0; i < midiEventCount; ++i)
+        {
+            const MidiEvent& event = midiEvents[i];
+            const uint32_t frame = std::min(event.frame, frames);
+
+            if (frame > framesDone)
+            {
+                render(outputs, framesDone, frame - framesDone);
+                framesDone = frame;
+            }
+
+            fEngine.handleMidi(event.size > MidiEvent::kDataSize ? event.dataExt : event.data, event.size);
+        }
+
+        if (framesDone < frames)
+            render(outputs, framesDone, frames - framesDone);
+
+        applyOutputGain(outL, outR, frames);
+
+        fEngineVoices = fEngine.getActiveVoiceCount();
+        fEngineChips = fEngine.getRunningChipCount();
+    }
+
+   /**
+      Render @a frames frames from @a offset, the chip buses of the multi-out build go straight to their outputs.
+    */
+    void render(float** outputs, uint32_t offset, uint32_t frames)
+    {
+#ifdef VGM_MULTI_OUT
+        float* buses[kMaxChips * 2];
+
+        for (uint32_t b = 0; b < kMaxChips * 2; ++b)
+            buses[b] = outputs[2 + b] + offset;
+
+        fEngine.render(outputs[0] + offset, outputs[1] + offset, buses, frames);
+#else
+        fEngine.render(outputs[0] + offset, outputs[1] + offset, frames);
+#endif
+    }
+
+    void clearOutputs(float** outputs, uint32_t frames)
+    {
+        for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_OUTPUTS; ++i)
+            std::memset(outputs[i], 0, sizeof(float) * frames);
+    }
+
+   /**
+      Apply gain against all samples, a block at a time.
+      A settled gain is a constant multiply, skipped altogether at unity.
+    */
+    void applyOutputGain(float* outL, float* outR, uint32_t frames)
+    {
+        VGM_PROFILE_SCOPE(fEngine.getProfileStats(), kProfileGain);
+
+        while (frames > 0 && ! fSmoothGain.isSettled())
         {
-            const float gain = fSmoothGain.next();
-            outL[i] = (0) * gain;
-            outR[i] = (0) * gain;
+            const uint32_t n = std::min(frames, SynthEngine::kMaxRenderFrames);
+
+            fSmoothGain.process(fGainRamp, n);
+            applyGainRamp(outL, fGainRamp, n);
+            applyGainRamp(outR, fGainRamp, n);
+
+            outL += n;
+            outR += n;
+            frames -= n;
         }
+
+        const float gain = fSmoothGain.getTargetValue();
+
+        if (frames == 0 || gain == 1.0f)
+            return;
+
+        applyGain(outL, gain, frames);
+        applyGain(outR, gain, frames);
     }
 
     // ----------------------------------------------------------------------------------------------------------------
@@ -236,6 +1209,8 @@ protected:
     void sampleRateChanged(double newSampleRate) override
     {
         fSmoothGain.setSampleRate(newSampleRate);
+        fEngine.setSampleRate(newSampleRate);
+        fLoadMeter.setSampleRate(newSampleRate);
         std::cout << "SR changed to " << newSampleRate << '\n';
     }
 
@@ -11,9 +11,15 @@
 #include "ResizeHandle.hpp"
 #include "DistrhoPluginUtils.hpp"
 
+#include <ctime>
 #include <filesystem>
 #include <json.hpp>
 
+#include "IncidentLog.hpp"
+#include "Parameters.hpp"
+#include "Routing.hpp"
+#include "Tracer.hpp"
+
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
@@ -23,7 +29,38 @@ START_NAMESPACE_DISTRHO
 
 class ImGuiPluginUI : public UI
 {
+    static constexpr const int kLoadHistorySize = 128;
+    static constexpr const int kIncidentHistorySize = 16;
+    static constexpr const int kIncidentFieldCount = kParamIncidentCount - kParamIncidentKind;
+
+    struct IncidentRow {
+        std::time_t time; // when the UI heard of it
+        float fields[kIncidentFieldCount];
+    };
+
     float fGain = 0.0f;
+    int fVoice = 0;
+    bool fMultiTimbral = false;
+    bool fMpe = false;
+    float fChipGain[kMaxChips] = {};
+    float fChipPan[kMaxChips] = {};
+    int fOutputModel = kOutputModelOff;
+    int fRenderAheadTime = 0;
+    int fRenderThreads = 1;
+    float fDspPeak = 0.0f;
+    float fLoadHistory[kLoadHistorySize] = {};
+    int fLoadHistoryPos = 0; // oldest value, the next one written
+    int fIncidentThreshold = 90;
+    int fIncidentCount = 0;
+    float fIncidentFields[kIncidentFieldCount] = {}; // of the last incident, from kParamIncidentKind on
+    IncidentRow fIncidents[kIncidentHistorySize] = {};
+    int fIncidentRows = 0;
+    char fIncidentFile[1024] = {};
+#ifdef VGM_PROFILING
+    float fProfileShare[kProfileStageCount] = {};
+#endif
+    ChannelRoute fRoutes[kMidiChannels];
+    bool fRoutesEdited = false; // not sent to the DSP until applied
     ResizeHandle fResizeHandle;
 
     // ----------------------------------------------------------------------------------------------------------------
@@ -44,6 +81,17 @@ public:
         // hide handle if UI is resizable
         if (isResizable())
             fResizeHandle.hide();
+
+        for (uint8_t c = 0; c < kMidiChannels; ++c)
+            fRoutes[c] = defaultChannelRoute(c);
+
+#ifdef _WIN32
+        const char* const home = std::getenv("USERPROFILE");
+#else
+        const char* const home = std::getenv("HOME");
+#endif
+        std::snprintf(fIncidentFile, sizeof(fIncidentFile), "%s",
+                      (fs::path(home != nullptr ? home : ".") / "vgm-incidents.json").string().c_str());
             
         // res = fs::path(getBinaryFilename()).parent_path().parent_path() / "Resources";
     }
@@ -69,6 +117,23 @@ protected:
          if (std::strcmp(key, "file") == 0)
          {
          }
+         else if (std::strcmp(key, "routing") == 0)
+         {
+           routingFromString(value, fRoutes);
+           fRoutesEdited = false;
+         }
+         else if (std::strcmp(key, "renderahead") == 0)
+         {
+           fRenderAheadTime = std::atoi(value);
+         }
+         else if (std::strcmp(key, "renderthreads") == 0)
+         {
+           fRenderThreads = std::atoi(value);
+         }
+         else if (std::strcmp(key, "incidentthreshold") == 0)
+         {
+           fIncidentThreshold = std::atoi(value);
+         }
          // trigger repaint
          repaint();
      }
@@ -80,15 +145,68 @@ protected:
     void parameterChanged(uint32_t index, float value) override
     {
         switch (index) {
-          case 0:
+          case kParamGain:
             fGain = value;
             break;
-          case 1:
+          case kParamVoice:
+            fVoice = int(value);
+            break;
+          case kParamMultiTimbral:
+            fMultiTimbral = value > 0.5f;
+            break;
+          case kParamMpe:
+            fMpe = value > 0.5f;
+            break;
+          case kParamOutputModel:
+            fOutputModel = int(value);
+            break;
+          case kParamDspLoad:
+            // one point per update from the host, which polls output parameters at its own rate
+            fLoadHistory[fLoadHistoryPos] = value;
+            fLoadHistoryPos = (fLoadHistoryPos + 1) % kLoadHistorySize;
+            break;
+          case kParamDspPeak:
+            fDspPeak = value;
+            break;
+          case kParamIncidentCount:
+            addIncident(int(value));
+            break;
+          default:
+#ifdef VGM_PROFILING
+            if (index >= kParamProfile)
+            {
+                fProfileShare[index - kParamProfile] = value;
+                break;
+            }
+#endif
+            if (index >= kParamIncidentKind && index < kParamIncidentCount)
+                fIncidentFields[index - kParamIncidentKind] = value;
+            else if (index >= kParamChipPan && index < kParamOutputModel)
+                fChipPan[index - kParamChipPan] = value;
+            else if (index >= kParamChipGain && index < kParamChipPan)
+                fChipGain[index - kParamChipGain] = value;
             break;
         }
         repaint();
     }
 
+   /**
+      The plugin counted a new incident, its fields came before the count.@n
+      Several incidents between two updates from the host show up as the last of them.
+    */
+    void addIncident(int count)
+    {
+        if (count == fIncidentCount)
+            return;
+
+        fIncidentCount = count;
+
+        std::memmove(fIncidents + 1, fIncidents, sizeof(IncidentRow) * (kIncidentHistorySize - 1));
+        fIncidents[0].time = std::time(nullptr);
+        std::memcpy(fIncidents[0].fields, fIncidentFields, sizeof(fIncidentFields));
+        fIncidentRows = std::min(fIncidentRows + 1, kIncidentHistorySize);
+    }
+
     // ----------------------------------------------------------------------------------------------------------------
     // Widget Callbacks
 
@@ -97,6 +215,9 @@ protected:
     */
     void onImGuiDisplay() override
     {
+        VGM_TRACE_THREAD_NAME("UI");
+        VGM_TRACE_SCOPE("UI frame");
+
         const float width = getWidth();
         const float height = getHeight();
 
@@ -120,21 +241,258 @@ protected:
             if (ImGui::SliderFloat("Gain (dB)", &fGain, -90.0f, 30.0f))
             {
                 if (ImGui::IsItemActivated())
-                    editParameter(0, true);
+                    editParameter(kParamGain, true);
 
-                setParameterValue(0, fGain);
+                setParameterValue(kParamGain, fGain);
             }
                 
             if (ImGui::IsItemDeactivated())
             {
-                editParameter(0, false);
+                editParameter(kParamGain, false);
             }
+
+            if (ImGui::SliderInt("Voice", &fVoice, 0, 128))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParamVoice, true);
+
+                setParameterValue(kParamVoice, fVoice);
+            }
+
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParamVoice, false);
+            }
+
+            if (ImGui::Checkbox("Multi-timbral", &fMultiTimbral))
+            {
+                editParameter(kParamMultiTimbral, true);
+                setParameterValue(kParamMultiTimbral, fMultiTimbral ? 1.0f : 0.0f);
+                editParameter(kParamMultiTimbral, false);
+            }
+
+            ImGui::SameLine();
+
+            if (ImGui::Checkbox("MPE", &fMpe))
+            {
+                editParameter(kParamMpe, true);
+                setParameterValue(kParamMpe, fMpe ? 1.0f : 0.0f);
+                editParameter(kParamMpe, false);
+            }
+
+            if (ImGui::CollapsingHeader("Mixer"))
+                drawMixer();
+
+            if (ImGui::CollapsingHeader("Performance"))
+                drawPerformance();
+
+            if (fMultiTimbral && ! fMpe)
+                drawRoutingTable();
             
             // ImGui::ShowDemoWindow(nullptr);
         }
         ImGui::End();
     }
 
+   /**
+      Gain and pan of each chip, channel volume and pan follow CC7 and CC10, then the console output stage.
+    */
+    void drawMixer()
+    {
+        for (uint8_t c = 0; c < kMaxChips; ++c)
+        {
+            ImGui::PushID(c);
+            ImGui::Text("Chip %d", c + 1);
+            ImGui::SameLine();
+            ImGui::PushItemWidth(ImGui::GetContentRegionAvail().x * 0.4f);
+
+            if (ImGui::SliderFloat("Gain (dB)", &fChipGain[c], -90.0f, 12.0f))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParamChipGain + c, true);
+
+                setParameterValue(kParamChipGain + c, fChipGain[c]);
+            }
+
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParamChipGain + c, false);
+            }
+
+            ImGui::SameLine();
+
+            if (ImGui::SliderFloat("Pan", &fChipPan[c], -1.0f, 1.0f))
+            {
+                if (ImGui::IsItemActivated())
+                    editParameter(kParamChipPan + c, true);
+
+                setParameterValue(kParamChipPan + c, fChipPan[c]);
+            }
+
+            if (ImGui::IsItemDeactivated())
+            {
+                editParameter(kParamChipPan + c, false);
+            }
+
+            ImGui::PopItemWidth();
+            ImGui::PopID();
+        }
+
+        const char* models[kOutputModelCount];
+
+        for (uint32_t i = 0; i < kOutputModelCount; ++i)
+            models[i] = outputModelName(i);
+
+        if (ImGui::Combo("Output model", &fOutputModel, models, kOutputModelCount))
+        {
+            editParameter(kParamOutputModel, true);
+            setParameterValue(kParamOutputModel, fOutputModel);
+            editParameter(kParamOutputModel, false);
+        }
+    }
+
+   /**
+      DSP load history, then the render-ahead time and render threads, both taking effect on the next activation.@n
+      With render ahead the engine runs on its own thread and the plugin reports the time as latency.
+    */
+    void drawPerformance()
+    {
+        const float load = fLoadHistory[(fLoadHistoryPos + kLoadHistorySize - 1) % kLoadHistorySize];
+        char overlay[64];
+
+        std::snprintf(overlay, sizeof(overlay), "DSP load %.1f%%, peak %.1f%%", load, fDspPeak);
+        ImGui::PlotLines("##load", fLoadHistory, kLoadHistorySize, fLoadHistoryPos, overlay,
+                         0.0f, 100.0f, ImVec2(ImGui::GetContentRegionAvail().x, 60.0f));
+
+#ifdef VGM_PROFILING
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+        {
+            std::snprintf(overlay, sizeof(overlay), "%s %.1f%%", profileStageName(s), fProfileShare[s]);
+            ImGui::ProgressBar(fProfileShare[s] / 100.0f, ImVec2(-1.0f, 0.0f), overlay);
+        }
+#endif
+
+        if (ImGui::InputInt("Render ahead (ms)", &fRenderAheadTime, 5, 20))
+        {
+            fRenderAheadTime = std::max(0, std::min(fRenderAheadTime, 200));
+            setState("renderahead", std::to_string(fRenderAheadTime).c_str());
+        }
+
+        if (ImGui::InputInt("Render threads", &fRenderThreads, 1, 1))
+        {
+            fRenderThreads = std::max(1, std::min(fRenderThreads, int(kMaxChips)));
+            setState("renderthreads", std::to_string(fRenderThreads).c_str());
+        }
+
+        ImGui::TextDisabled("Takes effect when the host restarts processing");
+
+        drawIncidents();
+    }
+
+   /**
+      Blocks over the threshold and render-ahead underruns, newest first, the plugin keeps more for the export.
+    */
+    void drawIncidents()
+    {
+        if (ImGui::InputInt("Incident threshold (%)", &fIncidentThreshold, 5, 20))
+        {
+            fIncidentThreshold = std::max(10, std::min(fIncidentThreshold, 1000));
+            setState("incidentthreshold", std::to_string(fIncidentThreshold).c_str());
+        }
+
+        ImGui::Text("%d incidents", fIncidentCount);
+
+        if (fIncidentRows != 0
+            && ImGui::BeginTable("incidents", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+        {
+            ImGui::TableSetupColumn("Time");
+            ImGui::TableSetupColumn("Kind");
+            ImGui::TableSetupColumn("Frames");
+            ImGui::TableSetupColumn("Load");
+            ImGui::TableSetupColumn("Voices");
+            ImGui::TableSetupColumn("Chips");
+            ImGui::TableSetupColumn("Events");
+            ImGui::TableHeadersRow();
+
+            for (int i = 0; i < fIncidentRows; ++i)
+            {
+                const IncidentRow& row = fIncidents[i];
+                char time[16];
+
+                std::strftime(time, sizeof(time), "%H:%M:%S", std::localtime(&row.time));
+
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(time);
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(incidentKindName(uint32_t(row.fields[0])));
+
+                for (uint32_t f = kParamIncidentFrames; f < kParamIncidentCount; ++f)
+                {
+                    ImGui::TableNextColumn();
+
+                    if (f == kParamIncidentLoad)
+                        ImGui::Text("%.0f%%", row.fields[f - kParamIncidentKind]);
+                    else
+                        ImGui::Text("%.0f", row.fields[f - kParamIncidentKind]);
+                }
+            }
+
+            ImGui::EndTable();
+        }
+
+        ImGui::InputText("##incidentfile", fIncidentFile, sizeof(fIncidentFile));
+        ImGui::SameLine();
+
+        if (ImGui::Button("Export incidents"))
+            setState("incidentlog", fIncidentFile);
+    }
+
+   /**
+      One row per MIDI channel: program, first voice and number of voices in the chip pool.@n
+      Edits are kept here until applied, a new routing table ends all notes and may start chips.
+    */
+    void drawRoutingTable()
+    {
+        if (! ImGui::BeginTable("routing", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+            return;
+
+        ImGui::TableSetupColumn("Channel");
+        ImGui::TableSetupColumn("Program");
+        ImGui::TableSetupColumn("First voice");
+        ImGui::TableSetupColumn("Voices");
+        ImGui::TableHeadersRow();
+
+        for (uint8_t c = 0; c < kMidiChannels; ++c)
+        {
+            int program = fRoutes[c].program;
+            int first = fRoutes[c].firstVoice;
+            int count = fRoutes[c].voiceCount;
+
+            ImGui::PushID(c);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", c + 1);
+            ImGui::TableNextColumn();
+            fRoutesEdited |= ImGui::InputInt("##program", &program);
+            ImGui::TableNextColumn();
+            fRoutesEdited |= ImGui::InputInt("##first", &first);
+            ImGui::TableNextColumn();
+            fRoutesEdited |= ImGui::InputInt("##count", &count);
+            ImGui::PopID();
+
+            fRoutes[c] = sanitizeChannelRoute(program, first, count);
+        }
+
+        ImGui::EndTable();
+
+        if (fRoutesEdited && ImGui::Button("Apply routing"))
+        {
+            setState("routing", routingToString(fRoutes).c_str());
+            fRoutesEdited = false;
+        }
+    }
+
     DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImGuiPluginUI)
 };
 
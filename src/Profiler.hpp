@@ -0,0 +1,109 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <x86intrin.h>
+# endif
+# define VGM_PROFILE_RDTSC
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Stages of the audio callback timed in profiling builds.@n
+   libvgm resamples while it clocks a chip, emulation and resampling are both in kProfileChips.
+ */
+enum ProfileStage {
+    kProfileMidi = 0,  // MIDI event handling, register writes of note and program changes included
+    kProfileControl,   // coalesced pitch and level updates, once per quantum
+    kProfileChips,     // chip emulation and resampling, the whole dispatch when chips render in parallel
+    kProfileMix,       // gain ramps, output stage filters and bus sums
+    kProfileGain,      // output gain of the plugin
+    kProfileStageCount
+};
+
+static inline const char* profileStageName(uint32_t stage) noexcept
+{
+    static const char* const kNames[kProfileStageCount] = { "MIDI", "Control", "Chips", "Mix", "Gain" };
+    return stage < kProfileStageCount ? kNames[stage] : "";
+}
+
+/**
+   Timestamp counter, CPU cycles where rdtsc exists, steady clock ticks otherwise.
+ */
+static inline uint64_t profileTicks() noexcept
+{
+#ifdef VGM_PROFILE_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Running totals of ticks and calls per stage.@n
+   Each stage only has one writer at a time, which adds without a locked instruction, readers take differences.
+ */
+struct ProfileStats {
+    std::atomic<uint64_t> ticks[kProfileStageCount];
+    std::atomic<uint64_t> calls[kProfileStageCount];
+
+    ProfileStats() noexcept
+    {
+        for (uint32_t s = 0; s < kProfileStageCount; ++s)
+        {
+            ticks[s].store(0, std::memory_order_relaxed);
+            calls[s].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint32_t stage, uint64_t elapsed) noexcept
+    {
+        ticks[stage].store(ticks[stage].load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+        calls[stage].store(calls[stage].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+/**
+   Adds the time until the end of the scope to a stage.
+ */
+class ProfileScope
+{
+public:
+    ProfileScope(ProfileStats& stats, uint32_t stage) noexcept
+        : fStats(stats),
+          fStage(stage),
+          fStart(profileTicks()) {}
+
+    ~ProfileScope() noexcept
+    {
+        fStats.add(fStage, profileTicks() - fStart);
+    }
+
+private:
+    ProfileStats& fStats;
+    const uint32_t fStage;
+    const uint64_t fStart;
+};
+
+// counters only exist in builds configured with VGM_PROFILING
+#ifdef VGM_PROFILING
+# define VGM_PROFILE_SCOPE(stats, stage) const ProfileScope vgmProfileScope(stats, stage)
+#else
+# define VGM_PROFILE_SCOPE(stats, stage)
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,50 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// scopes only exist in builds configured with VGM_RT_CHECK, which needs weak symbols
+#ifdef VGM_RT_CHECK
+
+/**
+   Entry points of the vgm-rtcheck library, null unless it is loaded, with LD_PRELOAD for a host.@n
+   While a thread is inside a realtime scope, the library reports allocations, blocking locks, sleeps and file or
+   console I/O on that thread with a stack trace.
+ */
+extern "C" {
+__attribute__((weak)) void vgm_rtcheck_enter(const char* context) noexcept;
+__attribute__((weak)) void vgm_rtcheck_leave() noexcept;
+}
+
+/**
+   Marks the thread as realtime until the end of the scope, scopes nest.
+ */
+class RealtimeScope
+{
+public:
+    explicit RealtimeScope(const char* context) noexcept
+    {
+        if (vgm_rtcheck_enter != nullptr)
+            vgm_rtcheck_enter(context);
+    }
+
+    ~RealtimeScope() noexcept
+    {
+        if (vgm_rtcheck_leave != nullptr)
+            vgm_rtcheck_leave();
+    }
+
+    RealtimeScope(const RealtimeScope&) = delete;
+    RealtimeScope& operator=(const RealtimeScope&) = delete;
+};
+
+# define VGM_REALTIME_SCOPE(context) const RealtimeScope vgmRealtimeScope(context)
+#else
+# define VGM_REALTIME_SCOPE(context)
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
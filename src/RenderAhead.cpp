@@ -0,0 +1,198 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "RenderAhead.hpp"
+#include "RealtimeCheck.hpp"
+#include "Tracer.hpp"
+
+#include <cstring>
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+
+RenderAhead::RenderAhead(SynthEngine& engine, Mutex& mutex, Client& client)
+    : Thread("RenderAhead"),
+      fEngine(engine),
+      fMutex(mutex),
+      fClient(client),
+      fSemaphore(0),
+      fActive(false),
+      fLatency(0),
+      fChannels(2),
+      fCapacity(0),
+      fHostPos(0),
+      fEnginePos(0),
+      fLimit(0),
+      fWritten(0),
+      fEvents(),
+      fEventWrite(0),
+      fEventRead(0),
+      fUnderruns(0)
+{
+}
+
+RenderAhead::~RenderAhead()
+{
+    stop();
+}
+
+uint32_t RenderAhead::start(uint32_t latency, uint32_t maxFrames, uint32_t channels)
+{
+    stop();
+
+    fLatency = std::max(latency, maxFrames * 2);
+    fChannels = std::min(channels, kMaxChannels);
+
+    // the worker never writes more than latency plus one block ahead of the audio thread
+    fCapacity = SynthEngine::kQuantumFrames;
+    while (fCapacity < fLatency + maxFrames)
+        fCapacity *= 2;
+
+    fRing.assign(static_cast<size_t>(fCapacity) * fChannels, 0.0f);
+
+    fHostPos = 0;
+    fEnginePos = 0;
+    fLimit.store(0);
+    fWritten.store(fLatency);
+    fEventWrite.store(0);
+    fEventRead.store(0);
+    fUnderruns.store(0);
+
+    fActive = startThread(true);
+    return fActive ? fLatency : 0;
+}
+
+void RenderAhead::stop()
+{
+    if (! fActive)
+        return;
+
+    signalThreadShouldExit();
+    fSemaphore.post();
+    stopThread(-1);
+    fActive = false;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void RenderAhead::queueMidi(uint32_t frame, const uint8_t* data, uint32_t size) noexcept
+{
+    // the engine only handles channel messages
+    if (size == 0 || size > 3)
+        return;
+
+    Event event = {};
+    event.frame = fHostPos + frame;
+    event.size = static_cast<uint8_t>(size);
+    std::memcpy(event.data, data, size);
+    pushEvent(event);
+}
+
+bool RenderAhead::pushEvent(const Event& event) noexcept
+{
+    const uint32_t write = fEventWrite.load(std::memory_order_relaxed);
+
+    DISTRHO_SAFE_ASSERT_RETURN(write - fEventRead.load(std::memory_order_acquire) < kEventCapacity, false);
+
+    fEvents[write % kEventCapacity] = event;
+    fEventWrite.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+void RenderAhead::process(float** outputs, uint32_t frames) noexcept
+{
+    const uint64_t start = fHostPos;
+
+    fHostPos += frames;
+    fLimit.store(fHostPos, std::memory_order_release);
+    fSemaphore.post();
+
+    // frames the worker has not finished are dropped, later frames stay aligned with their events
+    const uint64_t written = fWritten.load(std::memory_order_acquire);
+    const uint32_t ready = written > start ? static_cast<uint32_t>(std::min<uint64_t>(frames, written - start)) : 0;
+    const uint32_t pos = static_cast<uint32_t>(start & (fCapacity - 1));
+    const uint32_t first = std::min(ready, fCapacity - pos);
+
+    for (uint32_t c = 0; c < fChannels; ++c)
+    {
+        const float* const ring = fRing.data() + static_cast<size_t>(c) * fCapacity;
+
+        std::memcpy(outputs[c], ring + pos, sizeof(float) * first);
+        std::memcpy(outputs[c] + first, ring, sizeof(float) * (ready - first));
+        std::memset(outputs[c] + ready, 0, sizeof(float) * (frames - ready));
+    }
+
+    if (ready < frames)
+        fUnderruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void RenderAhead::run()
+{
+    VGM_TRACE_THREAD("Render ahead");
+
+    while (! shouldThreadExit())
+    {
+        fSemaphore.wait();
+
+        const uint64_t limit = fLimit.load(std::memory_order_acquire);
+        const MutexLocker cml(fMutex);
+        VGM_REALTIME_SCOPE("RenderAhead worker");
+        VGM_TRACE_SCOPE("Render ahead");
+
+        fClient.applyPendingParameters();
+
+        while (fEnginePos < limit)
+        {
+            uint64_t end = limit;
+            uint32_t read = fEventRead.load(std::memory_order_relaxed);
+            const uint32_t write = fEventWrite.load(std::memory_order_acquire);
+
+            // apply the events due, render up to the next one
+            for (; read != write; ++read)
+            {
+                const Event& event = fEvents[read % kEventCapacity];
+
+                if (event.frame > fEnginePos)
+                {
+                    end = std::min(end, event.frame);
+                    break;
+                }
+
+                fEngine.handleMidi(event.data, event.size);
+            }
+
+            fEventRead.store(read, std::memory_order_release);
+            renderUntil(end);
+        }
+    }
+}
+
+void RenderAhead::renderUntil(uint64_t end) noexcept
+{
+    while (fEnginePos < end)
+    {
+        const uint32_t pos = static_cast<uint32_t>((fEnginePos + fLatency) & (fCapacity - 1));
+        const uint32_t frames = static_cast<uint32_t>(std::min<uint64_t>(end - fEnginePos, fCapacity - pos));
+        float* channels[kMaxChannels];
+
+        for (uint32_t c = 0; c < fChannels; ++c)
+            channels[c] = fRing.data() + static_cast<size_t>(c) * fCapacity + pos;
+
+        if (fChannels > 2)
+            fEngine.render(channels[0], channels[1], channels + 2, frames);
+        else
+            fEngine.render(channels[0], channels[1], frames);
+
+        fEnginePos += frames;
+        fWritten.store(fEnginePos + fLatency, std::memory_order_release);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,121 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "DistrhoUtils.hpp"
+#include "extra/Mutex.hpp"
+#include "extra/Semaphore.hpp"
+#include "extra/Thread.hpp"
+
+#include "SynthEngine.hpp"
+
+#include <atomic>
+#include <vector>
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Renders the engine on a worker thread, a fixed latency behind the host.@n
+   The audio thread only queues the MIDI events of each block with their host frame,
+   then copies audio the worker finished earlier. The worker renders a block as soon as its events are known
+   and has until the block is due, latency minus block size frames later, so heavy cores do not weigh on the
+   host deadline.@n
+   start() and stop() are non-realtime, queueMidi() and process() belong to the audio thread.
+ */
+class RenderAhead : private Thread
+{
+public:
+   /**
+      Parameter changes may come from any thread, the plugin keeps them pending and applies them when the worker
+      asks, at the start of each block it renders, engine lock held.
+    */
+    struct Client {
+        virtual ~Client() {}
+        virtual void applyPendingParameters() noexcept = 0;
+    };
+
+    static constexpr const uint32_t kEventCapacity = 1024;
+    static constexpr const uint32_t kMaxChannels = 2 + kMaxChips * 2;
+
+    RenderAhead(SynthEngine& engine, Mutex& mutex, Client& client);
+    ~RenderAhead() override;
+
+   /**
+      Start rendering @a latency frames ahead, for host blocks of up to @a maxFrames frames.@n
+      The latency is raised to two blocks if needed, the worker always gets at least one block of time.
+      Returns the latency actually used, to report to the host.
+    */
+    uint32_t start(uint32_t latency, uint32_t maxFrames, uint32_t channels);
+    void stop();
+
+    bool isActive() const noexcept
+    {
+        return fActive;
+    }
+
+   /**
+      Blocks the worker was late for, rendered as silence.
+    */
+    uint32_t getUnderruns() const noexcept
+    {
+        return fUnderruns.load(std::memory_order_relaxed);
+    }
+
+   /**
+      Events queued by the audio thread and not yet applied by the worker.
+    */
+    uint32_t getPendingEvents() const noexcept
+    {
+        return fEventWrite.load(std::memory_order_relaxed) - fEventRead.load(std::memory_order_relaxed);
+    }
+
+    void queueMidi(uint32_t frame, const uint8_t* data, uint32_t size) noexcept;
+
+   /**
+      Hand the events queued since the last call to the worker and copy @a frames frames of finished audio.
+    */
+    void process(float** outputs, uint32_t frames) noexcept;
+
+private:
+    struct Event {
+        uint64_t frame; // host frame
+        uint8_t size;
+        uint8_t data[3];
+    };
+
+    void run() override;
+    bool pushEvent(const Event& event) noexcept;
+    void renderUntil(uint64_t end) noexcept;
+
+    SynthEngine& fEngine;
+    Mutex& fMutex;
+    Client& fClient;
+    Semaphore fSemaphore;
+    bool fActive;
+
+    uint32_t fLatency;
+    uint32_t fChannels;
+    uint32_t fCapacity; // ring size in frames, a power of two
+    std::vector<float> fRing; // fChannels planar rings of fCapacity frames
+
+    // host frame the audio thread is at, and the one the worker renders next, it is heard fLatency frames later
+    uint64_t fHostPos;
+    uint64_t fEnginePos;
+    std::atomic<uint64_t> fLimit;   // host frames whose events are all queued
+    std::atomic<uint64_t> fWritten; // ring frames finished, fLatency of silence ahead of the engine
+
+    Event fEvents[kEventCapacity];
+    std::atomic<uint32_t> fEventWrite;
+    std::atomic<uint32_t> fEventRead;
+
+    std::atomic<uint32_t> fUnderruns;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,89 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+// --------------------------------------------------------------------------------------------------------------------
+// Multi-timbral routing table, shared between DSP and UI
+
+static constexpr const uint8_t kMidiChannels = 16;
+static constexpr const uint8_t kMaxChips = 4;
+static constexpr const uint8_t kMaxVoices = kMaxChips * 6;
+static constexpr const uint8_t kMpeMaxMembers = 15;
+
+/**
+   Patch and slice of the chip voice pool used by a MIDI channel.@n
+   Voices are numbered across chips, voice @a v is channel @a v % 6 of chip @a v / 6.
+ */
+struct ChannelRoute {
+    uint8_t program = 0;
+    uint8_t firstVoice = 0;
+    uint8_t voiceCount = 0;
+};
+
+/**
+   Default multi-timbral layout, the voice pool split evenly over the 16 MIDI channels.
+ */
+static inline ChannelRoute defaultChannelRoute(uint8_t channel) noexcept
+{
+    ChannelRoute route;
+    route.firstVoice = channel * kMaxVoices / kMidiChannels;
+    route.voiceCount = (channel + 1) * kMaxVoices / kMidiChannels - route.firstVoice;
+    return route;
+}
+
+static inline ChannelRoute sanitizeChannelRoute(int program, int firstVoice, int voiceCount) noexcept
+{
+    ChannelRoute route;
+    route.program = static_cast<uint8_t>(std::min(127, std::max(0, program)));
+    route.firstVoice = static_cast<uint8_t>(std::min(kMaxVoices - 1, std::max(0, firstVoice)));
+    route.voiceCount = static_cast<uint8_t>(std::min(kMaxVoices - route.firstVoice, std::max(0, voiceCount)));
+    return route;
+}
+
+/**
+   The routing state is a JSON array of 16 objects with "program", "first" and "count".
+ */
+static inline std::string routingToString(const ChannelRoute routes[kMidiChannels])
+{
+    nlohmann::json j = nlohmann::json::array();
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+        j.push_back({ { "program", routes[c].program }, { "first", routes[c].firstVoice }, { "count", routes[c].voiceCount } });
+
+    return j.dump();
+}
+
+static inline bool routingFromString(const char* value, ChannelRoute routes[kMidiChannels])
+{
+    const nlohmann::json j = nlohmann::json::parse(value, nullptr, false);
+
+    if (! j.is_array())
+        return false;
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        if (c >= j.size() || ! j[c].is_object())
+        {
+            routes[c] = defaultChannelRoute(c);
+            continue;
+        }
+
+        const ChannelRoute def = defaultChannelRoute(c);
+        routes[c] = sanitizeChannelRoute(j[c].value("program", int(def.program)),
+                                         j[c].value("first", int(def.firstVoice)),
+                                         j[c].value("count", int(def.voiceCount)));
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
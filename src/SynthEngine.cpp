@@ -0,0 +1,971 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "SynthEngine.hpp"
+#include "Tracer.hpp"
+
+#include <emu/SoundDevs.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define EVENT_NOTEON 0x90
+#define EVENT_NOTEOFF 0x80
+#define EVENT_PITCHBEND 0xE0
+#define EVENT_PGMCHANGE 0xC0
+#define EVENT_CONTROLLER 0xB0
+#define EVENT_CHANPRESSURE 0xD0
+
+#define CC_BANK_SELECT_MSB 0
+#define CC_BANK_SELECT_LSB 32
+#define CC_DATA_ENTRY_MSB 6
+#define CC_VOLUME 7
+#define CC_PAN 10
+#define CC_SUSTAIN 64
+#define CC_SOSTENUTO 66
+#define CC_LEGATO 68
+#define CC_TIMBRE 74
+#define CC_RPN_LSB 100
+#define CC_RPN_MSB 101
+#define CC_ALL_SOUND_OFF 120
+#define CC_ALL_NOTES_OFF 123
+
+static constexpr const float kPitchBendRange = 2.0f; // semitones
+static constexpr const float kMpePitchBendRange = 48.0f; // semitones, MPE default for member channels
+
+#define RPN_PITCH_BEND_RANGE 0x0000
+#define RPN_MPE_CONFIGURATION 0x0006
+#define RPN_NULL 0x3FFF
+
+// libvgm samples are 24-bit
+static constexpr const float kSampleScale = 1.0f / 8388608.0f;
+
+// low-pass corner and Q, then the DC blocking high-pass corner, from the console schematics as far as 2 biquads go
+struct OutputStage {
+    float lowPass, lowPassQ, highPass;
+};
+
+static constexpr const OutputStage kOutputStages[kOutputModelCount] = {
+    { 0.0f, 0.0f, 0.0f },
+    { 3390.0f, 0.5f, 5.0f },
+    { 8000.0f, 0.6f, 5.0f },
+    { 11000.0f, 0.5f, 20.0f },
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+SynthEngine::SynthEngine()
+    : fStandbyChip(kMaxChips),
+      fSingleBank(0),
+      fSingleProgram(0),
+      fPendingProgram(-1),
+      fFadeChip(-1),
+      fFadePos(0),
+      fFadeLength(1),
+      fControlDirty(0),
+      fLevelDirty(0),
+      fLegato(0),
+      fSampleRate(44100),
+      fEmuCore(0),
+      fIdle(false),
+      fSilentFrames(0),
+      fIdleHoldFrames(1),
+      fChipSuspendTime(kDefaultChipSuspendTime),
+      fChipSuspendFrames(1),
+      fActive(false),
+      fMixCoef(1.0f),
+      fOutputModel(kOutputModelOff),
+      fQuantumPos(kQuantumFrames),
+      fQuantumBuses(false),
+      fDispatcher(nullptr),
+      fRenderVoices(0)
+{
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+        fChipSlots[c] = c;
+
+    std::memset(fChipSilentFrames, 0, sizeof(fChipSilentFrames));
+    std::memset(fChipRendered, 0, sizeof(fChipRendered));
+    std::memset(fChipPeak, 0, sizeof(fChipPeak));
+
+    std::memset(fBankSelect, 0, sizeof(fBankSelect));
+    std::memset(fChannelBank, 0, sizeof(fChannelBank));
+    std::memset(fPitchBend, 0, sizeof(fPitchBend));
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        fChannelProgram[c] = fAllocator.getRoutingTable()[c].program;
+        fBendRange[c] = kPitchBendRange;
+        fRpn[c] = RPN_NULL;
+        fPressure[c] = -1;
+        fTimbre[c] = 64;
+        fVolume[c] = 100;
+        fPan[c] = 64;
+    }
+
+    for (ChipMix& mix : fChipMix)
+    {
+        for (uint8_t s = 0; s < 2; ++s)
+            mix.target[s] = mix.current[s] = mix.start[s] = 1.0f;
+
+        mix.step[0] = mix.step[1] = 0.0f;
+    }
+
+    updateImages();
+}
+
+void SynthEngine::setSampleRate(double sampleRate)
+{
+    fSampleRate = static_cast<uint32_t>(sampleRate);
+    // a whole number of quanta, crossfades start and end on quantum boundaries
+    fFadeLength = std::max(1u, static_cast<uint32_t>(sampleRate * kPatchFadeTime + kQuantumFrames - 1) / kQuantumFrames) * kQuantumFrames;
+    fIdleHoldFrames = std::max(1u, static_cast<uint32_t>(sampleRate * kIdleHoldTime));
+    fMixCoef = 1.0f - std::exp(-static_cast<float>(kQuantumFrames) / std::max(1.0f, static_cast<float>(sampleRate * kMixSmoothTime)));
+    updateSuspendFrames();
+    updateOutputFilters();
+}
+
+void SynthEngine::setEmuCore(uint32_t core)
+{
+    fEmuCore = core;
+}
+
+void SynthEngine::setOutputModel(uint8_t model) noexcept
+{
+    if (model >= kOutputModelCount)
+        model = kOutputModelOff;
+
+    if (fOutputModel == model)
+        return;
+
+    fOutputModel = model;
+    updateOutputFilters();
+}
+
+void SynthEngine::updateOutputFilters() noexcept
+{
+    BiquadCascade::Coefficients stages[2];
+    uint32_t count = 0;
+
+    if (fOutputModel != kOutputModelOff)
+    {
+        const OutputStage& stage = kOutputStages[fOutputModel];
+        stages[count++] = BiquadCascade::lowPass(stage.lowPass, stage.lowPassQ, fSampleRate);
+        stages[count++] = BiquadCascade::highPass(stage.highPass, 0.7071f, fSampleRate);
+    }
+
+    fMixFilter.setStages(stages, count);
+
+    for (BiquadCascade& filter : fBusFilters)
+        filter.setStages(stages, count);
+}
+
+void SynthEngine::setChipSuspendTime(float seconds) noexcept
+{
+    fChipSuspendTime = std::max(0.0f, seconds);
+    updateSuspendFrames();
+}
+
+void SynthEngine::setChipMix(uint8_t position, float gain, float pan) noexcept
+{
+    ChipMix& mix = fChipMix[position % kMaxChips];
+
+    // balance, the chip output is already stereo
+    mix.target[0] = gain * std::min(1.0f, 1.0f - pan);
+    mix.target[1] = gain * std::min(1.0f, 1.0f + pan);
+}
+
+void SynthEngine::updateSuspendFrames() noexcept
+{
+    fChipSuspendFrames = std::max(1u, static_cast<uint32_t>(fSampleRate * fChipSuspendTime));
+}
+
+void SynthEngine::activate()
+{
+    for (VgmChip& chip : fChips)
+        chip.stop();
+
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+        fChipSlots[c] = c;
+
+    std::memset(fChipSilentFrames, 0, sizeof(fChipSilentFrames));
+    fActive = true;
+
+    // the standby chip swaps places with the first pool position, both are always needed
+    if (fChips[kMaxChips].start(DEVID_YM2612, kYm2612Clock, fSampleRate, fEmuCore))
+        ym2612Init(fChips[kMaxChips]);
+
+    prepareChips();
+
+    fStandbyChip = kMaxChips;
+    fFadeChip = -1;
+
+    fAllocator.reset();
+    std::memset(fPitchBend, 0, sizeof(fPitchBend));
+    std::memset(fVolume, 100, sizeof(fVolume));
+    std::memset(fPan, 64, sizeof(fPan));
+    fControlDirty = 0;
+    fLevelDirty = 0;
+    fQuantumPos = kQuantumFrames;
+    fLegato = 0;
+    fIdle = false;
+    fSilentFrames = 0;
+
+    fMixFilter.reset();
+    for (BiquadCascade& filter : fBusFilters)
+        filter.reset();
+
+    for (ChipMix& mix : fChipMix)
+    {
+        mix.current[0] = mix.target[0];
+        mix.current[1] = mix.target[1];
+    }
+}
+
+void SynthEngine::deactivate()
+{
+    fActive = false;
+
+    for (VgmChip& chip : fChips)
+        chip.stop();
+}
+
+void SynthEngine::prepareChips()
+{
+    if (! fActive)
+        return;
+
+    const VoiceMask voices = fAllocator.getRoutableVoices();
+
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+    {
+        VgmChip& chip = fChips[fChipSlots[c]];
+
+        if ((voices & chipVoices(c)) == 0 || chip.isRunning())
+            continue;
+
+        // silent until its first voice is keyed on
+        if (chip.start(DEVID_YM2612, kYm2612Clock, fSampleRate, fEmuCore))
+        {
+            ym2612Init(chip);
+            chip.suspend();
+        }
+
+        fChipSilentFrames[fChipSlots[c]] = 0;
+    }
+}
+
+void SynthEngine::setJobDispatcher(JobDispatcher* dispatcher) noexcept
+{
+    fDispatcher = dispatcher;
+}
+
+void SynthEngine::setLibrary(PatchLibrary& library)
+{
+    std::swap(fLibrary, library);
+    fAllocator.invalidateImages();
+    updateImages();
+}
+
+void SynthEngine::setProgram(uint8_t program) noexcept
+{
+    fPendingProgram = program & 0x7F;
+}
+
+void SynthEngine::setMultiTimbral(bool multiTimbral) noexcept
+{
+    if (fAllocator.isMultiTimbral() == multiTimbral)
+        return;
+
+    allNotesOff();
+    fAllocator.setMultiTimbral(multiTimbral);
+}
+
+void SynthEngine::setMpe(bool mpe) noexcept
+{
+    if (fAllocator.isMpe() == mpe)
+        return;
+
+    allNotesOff();
+    fAllocator.setMpe(mpe);
+
+    for (uint8_t c = 1; c < kMidiChannels; ++c)
+        fBendRange[c] = mpe ? kMpePitchBendRange : kPitchBendRange;
+}
+
+void SynthEngine::setRoute(uint8_t channel, const ChannelRoute& route) noexcept
+{
+    fAllocator.setRoute(channel, route);
+    fChannelProgram[channel] = route.program;
+    fChannelImage[channel] = &fLibrary.get(fChannelBank[channel], route.program);
+}
+
+void SynthEngine::updateImages() noexcept
+{
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+        fChannelImage[c] = &fLibrary.get(fChannelBank[c], fChannelProgram[c]);
+
+    fSingleImage = &fLibrary.get(fSingleBank, fSingleProgram);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void SynthEngine::handleMidi(const uint8_t* data, uint32_t size) noexcept
+{
+    VGM_PROFILE_SCOPE(fProfile, kProfileMidi);
+    VGM_TRACE_SCOPE("MIDI");
+
+    if (size < 2)
+        return;
+
+    const uint8_t status = data[0] & 0xF0;
+    const uint8_t channel = data[0] & 0x0F;
+    const uint8_t b1 = data[1];
+    const uint8_t b2 = size > 2 ? data[2] : 0;
+
+    switch (status) {
+      case EVENT_NOTEON:
+        if (b2 != 0)
+            noteOn(channel, b1, b2);
+        else
+            noteOff(channel, b1);
+        break;
+      case EVENT_NOTEOFF:
+        noteOff(channel, b1);
+        break;
+      case EVENT_PITCHBEND:
+        pitchBend(channel, (b2 << 7) | b1);
+        break;
+      case EVENT_PGMCHANGE:
+        programChange(channel, b1);
+        break;
+      case EVENT_CONTROLLER:
+        controlChange(channel, b1, b2 & 0x7F);
+        break;
+      case EVENT_CHANPRESSURE:
+        if (fAllocator.isMpe())
+        {
+            fPressure[channel] = b1 & 0x7F;
+            fControlDirty |= 1 << channel;
+        }
+        break;
+    }
+}
+
+void SynthEngine::controlChange(uint8_t channel, uint8_t control, uint8_t value) noexcept
+{
+    switch (control) {
+      case CC_BANK_SELECT_MSB:
+        fBankSelect[channel] = (value << 7) | (fBankSelect[channel] & 0x7F);
+        break;
+      case CC_BANK_SELECT_LSB:
+        fBankSelect[channel] = (fBankSelect[channel] & 0x3F80) | value;
+        break;
+      case CC_RPN_MSB:
+        fRpn[channel] = (value << 7) | (fRpn[channel] & 0x7F);
+        break;
+      case CC_RPN_LSB:
+        fRpn[channel] = (fRpn[channel] & 0x3F80) | value;
+        break;
+      case CC_DATA_ENTRY_MSB:
+        dataEntry(channel, value);
+        break;
+      case CC_VOLUME:
+        fVolume[channel] = value;
+        fLevelDirty |= 1 << channel;
+        break;
+      case CC_PAN:
+        fPan[channel] = value;
+        fLevelDirty |= 1 << channel;
+        break;
+      case CC_TIMBRE:
+        if (fAllocator.isMpe())
+        {
+            fTimbre[channel] = value;
+            fControlDirty |= 1 << channel;
+        }
+        break;
+      case CC_SUSTAIN:
+        keyOff(fAllocator.setSustain(pedalChannels(channel), value >= 64));
+        break;
+      case CC_SOSTENUTO:
+        keyOff(fAllocator.setSostenuto(pedalChannels(channel), value >= 64));
+        break;
+      case CC_LEGATO:
+        if (value >= 64)
+            fLegato |= 1 << channel;
+        else
+            fLegato &= ~(1 << channel);
+        break;
+      case CC_ALL_SOUND_OFF:
+      case CC_ALL_NOTES_OFF:
+        keyOff(fAllocator.releaseChannel(channel));
+        break;
+    }
+}
+
+void SynthEngine::dataEntry(uint8_t channel, uint8_t value) noexcept
+{
+    switch (fRpn[channel]) {
+      case RPN_PITCH_BEND_RANGE:
+        fBendRange[channel] = value;
+        break;
+      case RPN_MPE_CONFIGURATION:
+        // lower zone only, sent on the master channel
+        if (channel == 0 && fAllocator.isMpe())
+        {
+            allNotesOff();
+            fAllocator.setMpeMembers(std::min<uint8_t>(value, kMpeMaxMembers));
+            fBendRange[0] = kPitchBendRange;
+            for (uint8_t c = 1; c < kMidiChannels; ++c)
+                fBendRange[c] = kMpePitchBendRange;
+        }
+        break;
+    }
+}
+
+void SynthEngine::allNotesOff() noexcept
+{
+    keyOff(fAllocator.releaseAll());
+}
+
+uint32_t SynthEngine::getActiveVoiceCount() const noexcept
+{
+    uint32_t count = 0;
+
+    for (VoiceMask voices = fAllocator.getActiveVoices(); voices != 0; voices &= voices - 1)
+        ++count;
+
+    return count;
+}
+
+uint32_t SynthEngine::getRunningChipCount() const noexcept
+{
+    uint32_t count = 0;
+
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+    {
+        const VgmChip& chip = fChips[fChipSlots[c]];
+
+        if (chip.isRunning() && ! chip.isSuspended())
+            ++count;
+    }
+
+    return count;
+}
+
+void SynthEngine::keyOff(VoiceMask voices) noexcept
+{
+    for (; voices != 0; voices &= voices - 1)
+    {
+        const uint32_t v = lowestVoice(voices);
+        ym2612KeyOff(chipForVoice(v), v % kYm2612Channels);
+    }
+}
+
+void SynthEngine::startPatchSwitch() noexcept
+{
+    fSingleProgram = static_cast<uint8_t>(fPendingProgram);
+    fPendingProgram = -1;
+
+    const FmRegisterImage* const image = &fLibrary.get(fSingleBank, fSingleProgram);
+
+    if (image == fSingleImage)
+        return;
+
+    fSingleImage = image;
+
+    // in multi-timbral mode the single-timbral patch is only used once switching back,
+    // MPE voices span several chips so they pick it up on their next note
+    if (fAllocator.isMultiTimbral() || fAllocator.isMpe() || ! fChips[fStandbyChip].isRunning())
+        return;
+
+    // only register writes from the precomputed image, held notes are keyed on again with the new patch
+    VgmChip& standby = fChips[fStandbyChip];
+
+    for (uint8_t ch = 0; ch < kYm2612Channels; ++ch)
+    {
+        Voice& voice = fAllocator.getVoice(ch);
+
+        ym2612WriteImage(standby, ch, *image);
+        voice.image = image;
+
+        if (voice.note < 0)
+            continue;
+
+        ym2612WriteLevel(standby, ch, *image, attenuationForVoice(voice));
+        ym2612WritePan(standby, ch, *image, panToOutputs(fPan[voice.channel]));
+        ym2612WritePitch(standby, ch, ym2612Pitch(pitchForVoice(voice)));
+        ym2612KeyOn(standby, ch);
+    }
+
+    // the standby chip takes over the first pool position, the previous one fades out
+    fFadeChip = static_cast<int8_t>(fChipSlots[0]);
+    fChipSlots[0] = fStandbyChip;
+    fFadePos = 0;
+}
+
+void SynthEngine::noteOn(uint8_t channel, uint8_t note, uint8_t velocity) noexcept
+{
+    // legato: the sounding voice glides to the new note, without key-off and key-on
+    if ((fLegato & (1 << channel)) != 0)
+    {
+        const int v = fAllocator.legato(channel, note);
+
+        if (v >= 0)
+        {
+            updateVoiceControl(v);
+            return;
+        }
+    }
+
+    const int v = fAllocator.allocate(channel, note);
+
+    if (v < 0)
+        return;
+
+    fIdle = false;
+    fSilentFrames = 0;
+
+    const FmRegisterImage& image = imageForChannel(channel);
+    Voice& voice = fAllocator.getVoice(v);
+    voice.velocity = velocity;
+    fPressure[channel] = -1;
+    VgmChip& chip = chipForVoice(v);
+    const uint8_t chipChannel = v % kYm2612Channels;
+
+    // a stolen voice is still keyed on
+    ym2612KeyOff(chip, chipChannel);
+
+    if (voice.image != &image)
+    {
+        ym2612WriteImage(chip, chipChannel, image);
+        voice.image = &image;
+    }
+
+    // the image resets the output enable bits, and a reused voice may come from another channel
+    ym2612WriteLevel(chip, chipChannel, image, attenuationForVoice(voice));
+    ym2612WritePan(chip, chipChannel, image, panToOutputs(fPan[channel]));
+    ym2612WritePitch(chip, chipChannel, ym2612Pitch(pitchForVoice(voice)));
+
+    // MPE sends the initial timbre before the note, there is no default to rely on
+    if (fAllocator.isMpe())
+        ym2612WriteModulatorLevel(chip, chipChannel, image, timbreOffset(channel));
+
+    ym2612KeyOn(chip, chipChannel);
+}
+
+void SynthEngine::noteOff(uint8_t channel, uint8_t note) noexcept
+{
+    const int v = fAllocator.noteOff(channel, note);
+
+    if (v >= 0)
+        ym2612KeyOff(chipForVoice(v), v % kYm2612Channels);
+}
+
+void SynthEngine::pitchBend(uint8_t channel, uint16_t value) noexcept
+{
+    fPitchBend[channel] = (static_cast<int>(value) - 8192) * (fBendRange[channel] / 8192.0f);
+
+    // the MPE master channel bends every member
+    fControlDirty |= fAllocator.isMpe() && channel == 0 ? 0xFFFF : 1 << channel;
+}
+
+void SynthEngine::updateControl() noexcept
+{
+    const uint16_t dirty = fControlDirty | fLevelDirty;
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        const uint16_t bit = 1 << c;
+
+        if ((dirty & bit) == 0)
+            continue;
+
+        for (VoiceMask voices = fAllocator.getChannelVoices(c); voices != 0; voices &= voices - 1)
+        {
+            if ((fControlDirty & bit) != 0)
+                updateVoiceControl(lowestVoice(voices));
+            if ((fLevelDirty & bit) != 0)
+                updateVoiceLevel(lowestVoice(voices));
+        }
+    }
+
+    fControlDirty = 0;
+    fLevelDirty = 0;
+}
+
+void SynthEngine::updateVoiceControl(uint32_t v) noexcept
+{
+    const Voice& voice = fAllocator.getVoice(v);
+    VgmChip& chip = chipForVoice(v);
+    const uint8_t chipChannel = v % kYm2612Channels;
+
+    ym2612WritePitch(chip, chipChannel, ym2612Pitch(pitchForVoice(voice)));
+
+    if (! fAllocator.isMpe() || voice.image == nullptr)
+        return;
+
+    ym2612WriteLevel(chip, chipChannel, *voice.image, attenuationForVoice(voice));
+    ym2612WriteModulatorLevel(chip, chipChannel, *voice.image, timbreOffset(voice.channel));
+}
+
+void SynthEngine::updateVoiceLevel(uint32_t v) noexcept
+{
+    const Voice& voice = fAllocator.getVoice(v);
+
+    if (voice.image == nullptr)
+        return;
+
+    VgmChip& chip = chipForVoice(v);
+    const uint8_t chipChannel = v % kYm2612Channels;
+
+    ym2612WriteLevel(chip, chipChannel, *voice.image, attenuationForVoice(voice));
+    ym2612WritePan(chip, chipChannel, *voice.image, panToOutputs(fPan[voice.channel]));
+}
+
+void SynthEngine::programChange(uint8_t channel, uint8_t program) noexcept
+{
+    // only resolves the image, registers are written by the next note-on of each voice
+    const uint16_t bank = fBankSelect[channel];
+    const FmRegisterImage* const image = &fLibrary.get(bank, program);
+
+    if (usesChannelPrograms())
+    {
+        fChannelBank[channel] = bank;
+        fChannelProgram[channel] = program;
+        fChannelImage[channel] = image;
+    }
+    else
+    {
+        // switched like the Voice parameter, with a crossfade of held notes
+        fSingleBank = bank;
+        fPendingProgram = program & 0x7F;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void SynthEngine::render(float* outL, float* outR, float* const* buses, uint32_t frames) noexcept
+{
+    for (uint32_t done = 0; done < frames;)
+    {
+        if (fQuantumPos == kQuantumFrames)
+        {
+            // nothing can sound until the next note-on, a program change wakes the engine to run its crossfade
+            if (isIdle())
+            {
+                fControlDirty = 0;
+                fLevelDirty = 0;
+
+                std::memset(outL + done, 0, sizeof(float) * (frames - done));
+                std::memset(outR + done, 0, sizeof(float) * (frames - done));
+
+                for (uint8_t b = 0; buses != nullptr && b < kMaxChips * 2; ++b)
+                    std::memset(buses[b] + done, 0, sizeof(float) * (frames - done));
+                return;
+            }
+
+            float* bus[kMaxChips * 2];
+
+            // whole quanta are rendered straight into the output, only the remainder goes through the quantum buffer
+            if (frames - done >= kQuantumFrames)
+            {
+                for (uint8_t b = 0; buses != nullptr && b < kMaxChips * 2; ++b)
+                    bus[b] = buses[b] + done;
+
+                renderQuantum(outL + done, outR + done, buses != nullptr ? bus : nullptr);
+                done += kQuantumFrames;
+                continue;
+            }
+
+            for (uint8_t b = 0; b < kMaxChips * 2; ++b)
+                bus[b] = fQuantum[2 + b];
+
+            renderQuantum(fQuantum[0], fQuantum[1], buses != nullptr ? bus : nullptr);
+            fQuantumBuses = buses != nullptr;
+            fQuantumPos = 0;
+        }
+
+        const uint32_t n = std::min(frames - done, kQuantumFrames - fQuantumPos);
+
+        std::memcpy(outL + done, fQuantum[0] + fQuantumPos, sizeof(float) * n);
+        std::memcpy(outR + done, fQuantum[1] + fQuantumPos, sizeof(float) * n);
+
+        for (uint8_t b = 0; buses != nullptr && b < kMaxChips * 2; ++b)
+        {
+            if (fQuantumBuses)
+                std::memcpy(buses[b] + done, fQuantum[2 + b] + fQuantumPos, sizeof(float) * n);
+            else
+                std::memset(buses[b] + done, 0, sizeof(float) * n);
+        }
+
+        fQuantumPos += n;
+        done += n;
+    }
+}
+
+void SynthEngine::renderQuantum(float* outL, float* outR, float* const* buses) noexcept
+{
+    // woken up by a program change
+    fIdle = false;
+
+    if (fPendingProgram >= 0 && fFadeChip < 0)
+        startPatchSwitch();
+
+    if ((fControlDirty | fLevelDirty) != 0)
+    {
+        VGM_PROFILE_SCOPE(fProfile, kProfileControl);
+        VGM_TRACE_SCOPE("Control");
+        updateControl();
+    }
+
+    const VoiceMask activeVoices = fAllocator.getActiveVoices();
+    const bool fading = fFadeChip >= 0;
+    uint32_t jobs = 0;
+    int32_t peak = 0;
+
+    // chips are independent until mixed, only the ones with something to render are handed out
+    fRenderVoices = activeVoices;
+
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+    {
+        const VgmChip& chip = fChips[fChipSlots[c]];
+        fChipRendered[c] = false;
+
+        if ((c == 0 && fading) || (chip.isRunning() && ! chip.isSuspended()))
+            fRenderJobs[jobs++] = c;
+    }
+
+    {
+        VGM_PROFILE_SCOPE(fProfile, kProfileChips);
+        VGM_TRACE_SCOPE("Chips");
+
+        if (fDispatcher != nullptr && jobs > 1)
+        {
+            fDispatcher->dispatch(renderChipJob, this, jobs);
+        }
+        else
+        {
+            for (uint32_t j = 0; j < jobs; ++j)
+                renderChip(fRenderJobs[j]);
+        }
+    }
+
+    VGM_PROFILE_SCOPE(fProfile, kProfileMix);
+    VGM_TRACE_SCOPE("Mix");
+
+    std::memset(outL, 0, sizeof(float) * kQuantumFrames);
+    std::memset(outR, 0, sizeof(float) * kQuantumFrames);
+    updateChipMix();
+
+    float* bus[kMaxChips * 2];
+
+    for (uint8_t c = 0; c < kMaxChips; ++c)
+    {
+        // without buses every chip is summed straight into the main output
+        float* const busL = bus[c * 2] = buses != nullptr ? buses[c * 2] : outL;
+        float* const busR = bus[c * 2 + 1] = buses != nullptr ? buses[c * 2 + 1] : outR;
+
+        if (buses != nullptr)
+        {
+            std::memset(busL, 0, sizeof(float) * kQuantumFrames);
+            std::memset(busR, 0, sizeof(float) * kQuantumFrames);
+        }
+
+        if (c == 0 && fading)
+        {
+            renderPatchFade(busL, busR);
+        }
+        else if (fChipRendered[c])
+        {
+            mixChip(c, fChipBuffers[c], busL, busR);
+            peak = std::max(peak, fChipPeak[c]);
+        }
+    }
+
+    // the output stage is linear, the main mix is only filtered when it is not a sum of filtered buses
+    if (buses != nullptr)
+    {
+        for (uint8_t f = 0; f < kMaxChips / 2; ++f)
+            fBusFilters[f].process(bus + f * 4, 4, kQuantumFrames);
+
+        for (uint8_t b = 0; b < kMaxChips * 2; b += 2)
+        {
+            addBuffer(outL, bus[b], kQuantumFrames);
+            addBuffer(outR, bus[b + 1], kQuantumFrames);
+        }
+    }
+    else
+    {
+        fMixFilter.process(bus, 2, kQuantumFrames);
+    }
+
+    if (! fading && activeVoices == 0)
+        detectSilence(peak);
+}
+
+void SynthEngine::renderChipJob(void* context, uint32_t index) noexcept
+{
+    SynthEngine* const engine = static_cast<SynthEngine*>(context);
+    engine->renderChip(engine->fRenderJobs[index]);
+}
+
+void SynthEngine::renderChip(uint8_t position) noexcept
+{
+    // may run on any thread, only touches the chips of its pool position and their buffers
+    VGM_TRACE_SCOPE("Chip");
+    if (position == 0 && fFadeChip >= 0)
+    {
+        renderFadeChips();
+        return;
+    }
+
+    const uint8_t index = fChipSlots[position];
+    WAVE_32BS* const buffer = fChipBuffers[position];
+
+    // each chip is rendered on its own, then converted, scaled and summed into the output
+    std::memset(buffer, 0, sizeof(WAVE_32BS) * kQuantumFrames);
+    fChips[index].render(kQuantumFrames, buffer);
+
+    if ((fRenderVoices & chipVoices(position)) == 0)
+    {
+        fChipPeak[position] = detectChipSilence(index, buffer);
+    }
+    else
+    {
+        fChipSilentFrames[index] = 0;
+        fChipPeak[position] = 0;
+    }
+
+    fChipRendered[position] = true;
+}
+
+void SynthEngine::detectSilence(int32_t peak) noexcept
+{
+    if (peak >= kIdleThreshold)
+    {
+        fSilentFrames = 0;
+        return;
+    }
+
+    fSilentFrames += kQuantumFrames;
+
+    if (fSilentFrames >= fIdleHoldFrames)
+        fIdle = true;
+}
+
+int32_t SynthEngine::detectChipSilence(uint8_t index, const WAVE_32BS* buffer) noexcept
+{
+    // only for chips without voices, to tell when their release tails are over
+    int32_t peak = 0;
+
+    for (uint32_t i = 0; i < kQuantumFrames; ++i)
+        peak = std::max(peak, std::max(std::abs(buffer[i].L), std::abs(buffer[i].R)));
+
+    if (peak >= kIdleThreshold)
+    {
+        fChipSilentFrames[index] = 0;
+        return peak;
+    }
+
+    fChipSilentFrames[index] += kQuantumFrames;
+
+    if (fChipSilentFrames[index] >= fChipSuspendFrames)
+        fChips[index].suspend();
+
+    return peak;
+}
+
+void SynthEngine::updateChipMix() noexcept
+{
+    // one-pole smoothing evaluated once per quantum, the gains ramp linearly in between
+    const float coef = fMixCoef;
+
+    for (ChipMix& mix : fChipMix)
+    {
+        for (uint8_t s = 0; s < 2; ++s)
+        {
+            const float start = mix.current[s];
+            float end = start + (mix.target[s] - start) * coef;
+
+            if (std::fabs(end - mix.target[s]) < GainSmoother::kSettleThreshold)
+                end = mix.target[s];
+
+            mix.start[s] = start;
+            mix.step[s] = (end - start) / kQuantumFrames;
+            mix.current[s] = end;
+        }
+    }
+}
+
+void SynthEngine::mixChip(uint8_t position, const WAVE_32BS* buffer, float* outL, float* outR) noexcept
+{
+    const ChipMix& mix = fChipMix[position];
+
+    mixStereoRamp(reinterpret_cast<const int32_t*>(buffer), outL, outR,
+                  mix.start[0] * kSampleScale, mix.start[1] * kSampleScale,
+                  mix.step[0] * kSampleScale, mix.step[1] * kSampleScale, kQuantumFrames);
+}
+
+void SynthEngine::renderFadeChips() noexcept
+{
+    WAVE_32BS* const fadeOut = fFadeBuffers[0];
+    WAVE_32BS* const fadeIn = fFadeBuffers[1];
+
+    std::memset(fadeOut, 0, sizeof(WAVE_32BS) * kQuantumFrames);
+    std::memset(fadeIn, 0, sizeof(WAVE_32BS) * kQuantumFrames);
+
+    // a suspended chip is silent, the one faded in was just written to and resumed
+    if (! fChips[fFadeChip].isSuspended())
+        fChips[fFadeChip].render(kQuantumFrames, fadeOut);
+
+    if (! fChips[fChipSlots[0]].isSuspended())
+        fChips[fChipSlots[0]].render(kQuantumFrames, fadeIn);
+}
+
+void SynthEngine::renderPatchFade(float* outL, float* outR) noexcept
+{
+    const WAVE_32BS* const fadeOut = fFadeBuffers[0];
+    const WAVE_32BS* const fadeIn = fFadeBuffers[1];
+
+    // both chips share the first pool position mix, the crossfade is folded into their gain ramps
+    const ChipMix& mix = fChipMix[0];
+    const float fadeStart = static_cast<float>(fFadePos) / fFadeLength;
+    const float fadeEnd = static_cast<float>(fFadePos + kQuantumFrames) / fFadeLength;
+    float inStart[2], inStep[2], outStart[2], outStep[2];
+
+    for (uint8_t s = 0; s < 2; ++s)
+    {
+        const float start = mix.start[s] * kSampleScale;
+        const float end = (mix.start[s] + mix.step[s] * kQuantumFrames) * kSampleScale;
+
+        inStart[s] = start * fadeStart;
+        inStep[s] = (end * fadeEnd - inStart[s]) / kQuantumFrames;
+        outStart[s] = start * (1.0f - fadeStart);
+        outStep[s] = (end * (1.0f - fadeEnd) - outStart[s]) / kQuantumFrames;
+    }
+
+    mixStereoRamp(reinterpret_cast<const int32_t*>(fadeIn), outL, outR, inStart[0], inStart[1], inStep[0], inStep[1], kQuantumFrames);
+    mixStereoRamp(reinterpret_cast<const int32_t*>(fadeOut), outL, outR, outStart[0], outStart[1], outStep[0], outStep[1], kQuantumFrames);
+
+    fFadePos += kQuantumFrames;
+
+    if (fFadePos < fFadeLength)
+        return;
+
+    // the faded chip becomes the standby one, it is not rendered until the next switch
+    VgmChip& chip = fChips[fFadeChip];
+
+    for (uint8_t ch = 0; ch < kYm2612Channels; ++ch)
+        ym2612KeyOff(chip, ch);
+
+    fStandbyChip = static_cast<uint8_t>(fFadeChip);
+    fFadeChip = -1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
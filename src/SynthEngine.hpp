@@ -0,0 +1,312 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "DspKernels.hpp"
+#include "FmPatch.hpp"
+#include "JobDispatcher.hpp"
+#include "OutputModel.hpp"
+#include "Profiler.hpp"
+#include "VgmChip.hpp"
+#include "VoiceAllocator.hpp"
+
+#include <algorithm>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   The sound engine, a pool of YM2612 chips driven from MIDI.@n
+   Independent of the plugin framework so it can be driven by other hosts or tools.
+   activate(), deactivate() and setLibrary() are non-realtime, everything else may be called from the audio thread.
+ */
+class SynthEngine
+{
+public:
+    static constexpr const uint32_t kMaxRenderFrames = 256;
+    static constexpr const float kPatchFadeTime = 0.010f; // seconds
+    static constexpr const uint32_t kQuantumFrames = 64; // internal render size, also the control update period
+    static constexpr const float kIdleHoldTime = 0.050f; // seconds of silence before going idle
+    static constexpr const int32_t kIdleThreshold = 128; // about -96dB in libvgm 24-bit samples
+    static constexpr const float kDefaultChipSuspendTime = 0.100f; // seconds
+    static constexpr const float kMixSmoothTime = 0.020f; // chip gain and pan time constant, in seconds
+
+    SynthEngine();
+
+    void setSampleRate(double sampleRate);
+
+   /**
+      libvgm emulation core of the chips, as a four-character code, 0 for the default one.@n
+      Takes effect on the next activate().
+    */
+    void setEmuCore(uint32_t core);
+
+   /**
+      Only the chips the routing table can reach are started, the standby chip always is.
+    */
+    void activate();
+    void deactivate();
+
+   /**
+      Start the chips newly reachable after routing changes, non-realtime.
+    */
+    void prepareChips();
+
+   /**
+      Time a chip without held or sustained voices has to stay below kIdleThreshold before it is suspended.
+      Suspended chips are not rendered, their state is kept and the next register write resumes them.
+    */
+    void setChipSuspendTime(float seconds) noexcept;
+
+   /**
+      Linear gain and balance (-1 to 1) of the chip at pool @a position, smoothed at control rate.
+    */
+    void setChipMix(uint8_t position, float gain, float pan) noexcept;
+
+   /**
+      Output stage filter, applied once to the main mix, or to each chip bus when rendering them.
+    */
+    void setOutputModel(uint8_t model) noexcept;
+
+   /**
+      Clock the chips of each quantum through @a dispatcher, in parallel if it allows, null to clock them in turn.@n
+      Mixing always happens on the rendering thread. Must not run concurrently with render().
+    */
+    void setJobDispatcher(JobDispatcher* dispatcher) noexcept;
+
+   /**
+      Swap in a new patch library, the previous contents end up in @a library.
+      Must not run concurrently with the audio thread functions.
+    */
+    void setLibrary(PatchLibrary& library);
+
+   /**
+      Program of single-timbral mode, in the currently selected bank.@n
+      Held notes switch to the new patch on a standby chip, crossfaded with the current one at the next render().
+      Changes requested during a crossfade are applied when it ends.
+    */
+    void setProgram(uint8_t program) noexcept;
+    void setMultiTimbral(bool multiTimbral) noexcept;
+
+   /**
+      MPE mode, lower zone with channel 1 as master, takes precedence over multi-timbral mode.@n
+      Member channels play the single-timbral patch on their own voice,
+      their pitch bend, channel pressure and CC74 drive F-number, carrier and modulator levels.
+    */
+    void setMpe(bool mpe) noexcept;
+    void setRoute(uint8_t channel, const ChannelRoute& route) noexcept;
+
+    const ChannelRoute* getRoutingTable() const noexcept
+    {
+        return fAllocator.getRoutingTable();
+    }
+
+    void handleMidi(const uint8_t* data, uint32_t size) noexcept;
+    void allNotesOff() noexcept;
+
+   /**
+      Render @a frames frames of all chips, replacing the contents of @a outL and @a outR.@n
+      Chips always run kQuantumFrames at a time, whatever @a frames is. The part of the last quantum not asked for
+      is kept for the next call, so MIDI handled in between takes effect at the next quantum boundary.
+    */
+    void render(float* outL, float* outR, uint32_t frames) noexcept
+    {
+        render(outL, outR, nullptr, frames);
+    }
+
+   /**
+      Same as above, also writing each chip of the pool to its own stereo bus, after its gain and pan.@n
+      @a buses holds the left and right pointers of every pool position in turn, the main output is their sum.
+    */
+    void render(float* outL, float* outR, float* const* buses, uint32_t frames) noexcept;
+
+   /**
+      True once no voice is sounding and the output has stayed below kIdleThreshold for kIdleHoldTime.@n
+      While idle render() only clears the output and the chips are not clocked, the next note-on
+      or program change wakes the engine.
+    */
+    bool isIdle() const noexcept
+    {
+        return fIdle && fPendingProgram < 0;
+    }
+
+   /**
+      Voices allocated to a note, and chips clocked by render(), for diagnostics.
+    */
+    uint32_t getActiveVoiceCount() const noexcept;
+    uint32_t getRunningChipCount() const noexcept;
+
+#ifdef VGM_PROFILING
+   /**
+      Time spent in each stage of rendering, the plugin adds its own output gain stage.
+    */
+    ProfileStats& getProfileStats() noexcept
+    {
+        return fProfile;
+    }
+#endif
+
+private:
+    void noteOn(uint8_t channel, uint8_t note, uint8_t velocity) noexcept;
+    void noteOff(uint8_t channel, uint8_t note) noexcept;
+    void pitchBend(uint8_t channel, uint16_t value) noexcept;
+    void programChange(uint8_t channel, uint8_t program) noexcept;
+    void controlChange(uint8_t channel, uint8_t control, uint8_t value) noexcept;
+    void dataEntry(uint8_t channel, uint8_t value) noexcept;
+    void updateControl() noexcept;
+    void updateVoiceControl(uint32_t voice) noexcept;
+    void updateVoiceLevel(uint32_t voice) noexcept;
+    void keyOff(VoiceMask voices) noexcept;
+
+    uint16_t pedalChannels(uint8_t channel) const noexcept
+    {
+        // in MPE mode the master channel pedals apply to all members
+        return fAllocator.isMpe() && channel == 0 ? 0xFFFF : 1 << channel;
+    }
+
+    bool usesChannelPrograms() const noexcept
+    {
+        return fAllocator.isMultiTimbral() && ! fAllocator.isMpe();
+    }
+
+    float pitchForVoice(const Voice& voice) const noexcept
+    {
+        // in MPE mode the master channel bend applies to all notes
+        return voice.note + fPitchBend[voice.channel] + (fAllocator.isMpe() ? fPitchBend[0] : 0.0f);
+    }
+
+    uint8_t attenuationForVoice(const Voice& voice) const noexcept
+    {
+        // once pressure is received it replaces the velocity
+        const int16_t pressure = fAllocator.isMpe() ? fPressure[voice.channel] : -1;
+        const int attenuation = velocityToAttenuation(pressure >= 0 ? pressure : voice.velocity)
+                              + velocityToAttenuation(fVolume[voice.channel]);
+        return static_cast<uint8_t>(std::min(attenuation, 127));
+    }
+
+    int timbreOffset(uint8_t channel) const noexcept
+    {
+        // CC74 above the center makes modulators louder, so the sound brighter
+        return (64 - fTimbre[channel]) / 2;
+    }
+    void updateImages() noexcept;
+    void startPatchSwitch() noexcept;
+    void renderQuantum(float* outL, float* outR, float* const* buses) noexcept;
+    void renderPatchFade(float* outL, float* outR) noexcept;
+    void renderChip(uint8_t position) noexcept;
+    void renderFadeChips() noexcept;
+    static void renderChipJob(void* context, uint32_t index) noexcept;
+    void detectSilence(int32_t peak) noexcept;
+    int32_t detectChipSilence(uint8_t index, const WAVE_32BS* buffer) noexcept;
+    void updateSuspendFrames() noexcept;
+    void updateChipMix() noexcept;
+    void mixChip(uint8_t position, const WAVE_32BS* buffer, float* outL, float* outR) noexcept;
+    void updateOutputFilters() noexcept;
+
+    static VoiceMask chipVoices(uint8_t position) noexcept
+    {
+        return static_cast<VoiceMask>(0x3F) << (position * kYm2612Channels);
+    }
+
+    const FmRegisterImage& imageForChannel(uint8_t channel) const noexcept
+    {
+        return usesChannelPrograms() ? *fChannelImage[channel] : *fSingleImage;
+    }
+
+    VgmChip& chipForVoice(uint32_t voice) noexcept
+    {
+        return fChips[fChipSlots[voice / kYm2612Channels]];
+    }
+
+    // one more chip than the pool, the standby chip patch switches are prepared on
+    VgmChip fChips[kMaxChips + 1];
+    uint8_t fChipSlots[kMaxChips]; // pool position to fChips index
+    uint8_t fStandbyChip;
+    VoiceAllocator fAllocator;
+    PatchLibrary fLibrary;
+
+    // per MIDI channel program state, bank select only takes effect on the next program change
+    uint16_t fBankSelect[kMidiChannels];
+    uint16_t fChannelBank[kMidiChannels];
+    uint8_t fChannelProgram[kMidiChannels];
+    const FmRegisterImage* fChannelImage[kMidiChannels];
+
+    // program state of single-timbral mode, program changes on any channel apply
+    uint16_t fSingleBank;
+    uint8_t fSingleProgram;
+    const FmRegisterImage* fSingleImage;
+    int16_t fPendingProgram; // -1 if none
+
+    // chip being faded out after a patch switch, -1 if none
+    int8_t fFadeChip;
+    uint32_t fFadePos;
+    uint32_t fFadeLength;
+
+    float fPitchBend[kMidiChannels]; // in semitones
+    float fBendRange[kMidiChannels]; // in semitones
+    uint16_t fRpn[kMidiChannels];    // selected RPN, MSB << 7 | LSB
+
+    // MPE expression, pressure is -1 until received for the current note
+    int16_t fPressure[kMidiChannels];
+    uint8_t fTimbre[kMidiChannels];
+
+    // channel volume and pan (CC7 and CC10), applied through carrier levels and output enable bits
+    uint8_t fVolume[kMidiChannels];
+    uint8_t fPan[kMidiChannels];
+
+    // pitch and expression changes are coalesced per channel and written once per quantum
+    uint16_t fControlDirty;
+    uint16_t fLevelDirty;
+
+    uint16_t fLegato; // legato footswitch, one bit per MIDI channel
+    uint32_t fSampleRate;
+    uint32_t fEmuCore;
+
+    bool fIdle;
+    uint32_t fSilentFrames;
+    uint32_t fIdleHoldFrames;
+
+    // per fChips index, frames rendered below kIdleThreshold without voices
+    uint32_t fChipSilentFrames[kMaxChips + 1];
+    float fChipSuspendTime;
+    uint32_t fChipSuspendFrames;
+    bool fActive;
+
+    // per pool position, left and right gains ramp linearly over each chunk towards their smoothed value
+    struct ChipMix {
+        float target[2];
+        float current[2];
+        float start[2];
+        float step[2];
+    };
+    ChipMix fChipMix[kMaxChips];
+    float fMixCoef; // one-pole coefficient over a quantum
+
+    // output stage, the bus filters hold two chip buses each
+    uint8_t fOutputModel;
+    BiquadCascade fMixFilter;
+    BiquadCascade fBusFilters[kMaxChips / 2];
+    static_assert(kMaxChips % 2 == 0, "each bus filter holds two chip buses");
+
+    // last quantum, main mix then chip buses, fQuantumPos frames of it already returned
+    float fQuantum[2 + kMaxChips * 2][kQuantumFrames];
+    uint32_t fQuantumPos;
+    bool fQuantumBuses; // whether the buses of the last quantum were rendered
+
+    // chips clocked this quantum, each into the buffer of its pool position, see renderChip()
+    JobDispatcher* fDispatcher;
+    VoiceMask fRenderVoices;
+    uint8_t fRenderJobs[kMaxChips];
+    bool fChipRendered[kMaxChips];
+    int32_t fChipPeak[kMaxChips];
+    WAVE_32BS fChipBuffers[kMaxChips][kQuantumFrames];
+
+#ifdef VGM_PROFILING
+    ProfileStats fProfile;
+#endif
+    WAVE_32BS fFadeBuffers[2][kQuantumFrames];
+};
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,221 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "Tracer.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+using json = nlohmann::json;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+/**
+   Span buffer of one thread, a ring with the owning thread as the writer and the recorder as the reader.@n
+   A span with a zero end names the thread rather than timing something.
+ */
+struct TraceSlot {
+    std::atomic<std::thread::id> owner; // a default id when the slot is free
+    uint32_t serial;
+    bool named;
+    std::atomic<uint32_t> read;
+    std::atomic<uint32_t> write;
+    TraceSpan spans[kTraceBufferSize];
+
+    TraceSlot() noexcept
+        : owner(std::thread::id()),
+          serial(0),
+          named(false),
+          read(0),
+          write(0) {}
+};
+
+// static TLS on Linux, the first span of a thread must not allocate, in a plugin loaded with dlopen() either
+#if defined(__GNUC__) && defined(__linux__)
+# define TRACE_TLS __thread __attribute__((tls_model("initial-exec")))
+#else
+# define TRACE_TLS thread_local
+#endif
+
+static TraceSlot gSlots[kMaxTraceThreads];
+static std::atomic<uint32_t> gNextSerial { 1 };
+static std::atomic<uint64_t> gDropped { 0 };
+
+// slot of the calling thread once found or claimed, spans never search for it again
+static TRACE_TLS TraceSlot* tSlot = nullptr;
+
+static TraceSlot* threadSlot(bool claim) noexcept
+{
+    if (tSlot != nullptr || ! claim)
+        return tSlot;
+
+    const std::thread::id self = std::this_thread::get_id();
+
+    // a thread that exited without releasing its slot, under an id now reused
+    for (TraceSlot& slot : gSlots)
+    {
+        if (slot.owner.load(std::memory_order_acquire) == self)
+            return tSlot = &slot;
+    }
+
+    for (TraceSlot& slot : gSlots)
+    {
+        std::thread::id free;
+
+        if (slot.owner.compare_exchange_strong(free, self, std::memory_order_acq_rel))
+        {
+            slot.serial = gNextSerial.fetch_add(1, std::memory_order_relaxed);
+            slot.named = false;
+            return tSlot = &slot;
+        }
+    }
+
+    return nullptr;
+}
+
+static void push(TraceSlot& slot, const char* name, uint64_t start, uint64_t end) noexcept
+{
+    const uint32_t write = slot.write.load(std::memory_order_relaxed);
+
+    if (write - slot.read.load(std::memory_order_acquire) >= kTraceBufferSize)
+    {
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    slot.spans[write % kTraceBufferSize] = { name, start, end, slot.serial };
+    slot.write.store(write + 1, std::memory_order_release);
+}
+
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+uint64_t traceNow() noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void traceSpan(const char* name, uint64_t start, uint64_t end) noexcept
+{
+    if (TraceSlot* const slot = threadSlot(true))
+        push(*slot, name, start, end);
+    else
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void traceThreadName(const char* name) noexcept
+{
+    TraceSlot* const slot = threadSlot(true);
+
+    if (slot == nullptr || slot->named)
+        return;
+
+    slot->named = true;
+    push(*slot, name, 0, 0);
+}
+
+void traceThreadEnd() noexcept
+{
+    if (TraceSlot* const slot = threadSlot(false))
+    {
+        tSlot = nullptr;
+        slot->owner.store(std::thread::id(), std::memory_order_release);
+    }
+}
+
+uint64_t traceDroppedSpans() noexcept
+{
+    return gDropped.load(std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void TraceRecorder::collect()
+{
+    for (TraceSlot& slot : gSlots)
+    {
+        uint32_t read = slot.read.load(std::memory_order_relaxed);
+        const uint32_t write = slot.write.load(std::memory_order_acquire);
+
+        for (; read != write; ++read)
+        {
+            const TraceSpan& span = slot.spans[read % kTraceBufferSize];
+
+            if (span.end == 0)
+                fThreadNames[span.thread] = span.name;
+            else
+                fSpans.push_back(span);
+        }
+
+        slot.read.store(read, std::memory_order_release);
+    }
+
+    if (fSpans.size() > kMaxSpans)
+    {
+        const size_t discard = fSpans.size() - kMaxSpans / 2;
+        fSpans.erase(fSpans.begin(), fSpans.begin() + discard);
+        fDiscarded += discard;
+    }
+}
+
+bool TraceRecorder::writeChromeTrace(const char* filename, std::string& error) const
+{
+    std::ofstream file(filename);
+
+    if (! file.is_open())
+    {
+        error = "cannot open the file for writing";
+        return false;
+    }
+
+    uint64_t origin = UINT64_MAX;
+    for (const TraceSpan& span : fSpans)
+        origin = std::min(origin, span.start);
+
+    // one event per line, a whole recording as a single json value would need gigabytes
+    file << "{\"displayTimeUnit\":\"ms\",\"otherData\":"
+         << json { { "dropped", traceDroppedSpans() }, { "discarded", fDiscarded } }.dump()
+         << ",\"traceEvents\":[\n";
+
+    bool first = true;
+    const auto writeEvent = [&file, &first](const json& event) {
+        file << (first ? "" : ",\n") << event.dump();
+        first = false;
+    };
+
+    for (const auto& thread : fThreadNames)
+    {
+        writeEvent(json { { "name", "thread_name" }, { "ph", "M" }, { "pid", 1 }, { "tid", thread.first },
+                          { "args", { { "name", thread.second } } } });
+    }
+
+    for (const TraceSpan& span : fSpans)
+    {
+        // complete events, microseconds from the first span
+        writeEvent(json { { "name", span.name }, { "ph", "X" }, { "pid", 1 }, { "tid", span.thread },
+                          { "ts", (span.start - origin) / 1000.0 }, { "dur", (span.end - span.start) / 1000.0 } });
+    }
+
+    file << "\n]}\n";
+
+    if (! file.good())
+    {
+        error = "write error";
+        return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,147 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static constexpr const uint32_t kMaxTraceThreads = 32;
+static constexpr const uint32_t kTraceBufferSize = 16384; // spans per thread between two collections
+
+/**
+   A timed span of one thread, @a name points to a string literal.@n
+   Times are steady clock nanoseconds, the same clock on every thread.
+ */
+struct TraceSpan {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint32_t thread; // serial number of the thread, never reused within a process
+};
+
+/**
+   Steady clock time in nanoseconds.
+ */
+uint64_t traceNow() noexcept;
+
+/**
+   Record a span of the calling thread, realtime safe.@n
+   Each thread writes to a buffer of its own, claimed on its first span and kept in a thread local. Spans are
+   dropped when the buffer is full or when more than kMaxTraceThreads threads trace at once.
+ */
+void traceSpan(const char* name, uint64_t start, uint64_t end) noexcept;
+
+/**
+   Name the calling thread in the trace, realtime safe, the name is kept until the thread releases its buffer.@n
+   For host threads, which are never released, naming them again has no effect.
+ */
+void traceThreadName(const char* name) noexcept;
+
+/**
+   Release the buffer of the calling thread for another one, its spans are still collected.
+ */
+void traceThreadEnd() noexcept;
+
+/**
+   Number of spans dropped so far, for a full buffer or a thread without one.
+ */
+uint64_t traceDroppedSpans() noexcept;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Adds a span from construction until the end of the scope.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) noexcept
+        : fName(name),
+          fStart(traceNow()) {}
+
+    ~TraceScope() noexcept
+    {
+        traceSpan(fName, fStart, traceNow());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* const fName;
+    const uint64_t fStart;
+};
+
+/**
+   Names a thread the plugin owns for as long as it runs, its buffer is released when the scope ends.
+ */
+class TraceThread
+{
+public:
+    explicit TraceThread(const char* name) noexcept
+    {
+        traceThreadName(name);
+    }
+
+    ~TraceThread() noexcept
+    {
+        traceThreadEnd();
+    }
+
+    TraceThread(const TraceThread&) = delete;
+    TraceThread& operator=(const TraceThread&) = delete;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Collects the spans of every thread and writes them as Chrome trace JSON, for chrome://tracing or Perfetto.@n
+   Not realtime safe, collect() must be called often enough that the thread buffers do not fill up. The thread
+   buffers have a single reader, only one recorder may collect in a process.
+ */
+class TraceRecorder
+{
+public:
+    // the oldest half is discarded beyond this, about 100 MB of spans
+    static constexpr const size_t kMaxSpans = 4 * 1024 * 1024;
+
+   /**
+      Move the spans of all thread buffers into the recording.
+    */
+    void collect();
+
+   /**
+      Write the recording, returns false and sets @a error on failure.
+    */
+    bool writeChromeTrace(const char* filename, std::string& error) const;
+
+    size_t getSpanCount() const noexcept
+    {
+        return fSpans.size();
+    }
+
+private:
+    std::vector<TraceSpan> fSpans;
+    std::map<uint32_t, std::string> fThreadNames;
+    uint64_t fDiscarded = 0;
+};
+
+// spans only exist in builds configured with VGM_TRACING
+#ifdef VGM_TRACING
+# define VGM_TRACE_SCOPE(name) const TraceScope vgmTraceScope(name)
+# define VGM_TRACE_THREAD(name) const TraceThread vgmTraceThread(name)
+# define VGM_TRACE_THREAD_NAME(name) traceThreadName(name)
+#else
+# define VGM_TRACE_SCOPE(name)
+# define VGM_TRACE_THREAD(name)
+# define VGM_TRACE_THREAD_NAME(name)
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
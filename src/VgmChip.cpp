@@ -0,0 +1,85 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "VgmChip.hpp"
+
+#include <emu/SoundEmu.h>
+
+#include <cstring>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void nullWrite(void*, UINT8, UINT8)
+{
+}
+
+VgmChip::VgmChip()
+    : fWrite(nullWrite),
+      fRunning(false),
+      fSuspended(false)
+{
+    std::memset(&fDevInfo, 0, sizeof(fDevInfo));
+    std::memset(&fResampler, 0, sizeof(fResampler));
+}
+
+VgmChip::~VgmChip()
+{
+    stop();
+}
+
+bool VgmChip::start(uint8_t deviceId, uint32_t clock, uint32_t sampleRate, uint32_t emuCore)
+{
+    stop();
+
+    DEV_GEN_CFG cfg;
+    std::memset(&cfg, 0, sizeof(cfg));
+    cfg.emuCore = emuCore;
+    cfg.srMode = DEVRI_SRMODE_NATIVE;
+    cfg.clock = clock;
+    cfg.smplRate = sampleRate;
+
+    if (SndEmu_Start(deviceId, &cfg, &fDevInfo) != 0x00)
+        return false;
+
+    void* writeFunc = nullptr;
+    if (SndEmu_GetDeviceFunc(fDevInfo.devDef, RWF_REGISTER | RWF_WRITE, DEVRW_A8D8, 0, &writeFunc) != 0x00)
+    {
+        SndEmu_Stop(&fDevInfo);
+        return false;
+    }
+    fWrite = reinterpret_cast<DEVFUNC_WRITE_A8D8>(writeFunc);
+
+    fDevInfo.devDef->Reset(fDevInfo.dataPtr);
+
+    Resmpl_SetVals(&fResampler, 0xFF, 0x100, sampleRate);
+    Resmpl_DevConnect(&fResampler, &fDevInfo);
+    Resmpl_Init(&fResampler);
+
+    fRunning = true;
+    fSuspended = false;
+    return true;
+}
+
+void VgmChip::stop()
+{
+    if (! fRunning)
+        return;
+
+    fRunning = false;
+    fSuspended = false;
+    fWrite = nullWrite;
+
+    Resmpl_Deinit(&fResampler);
+    SndEmu_Stop(&fDevInfo);
+    SndEmu_FreeDevLinkData(&fDevInfo);
+}
+
+void VgmChip::reset()
+{
+    if (fRunning)
+        fDevInfo.devDef->Reset(fDevInfo.dataPtr);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
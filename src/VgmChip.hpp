@@ -0,0 +1,87 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <stdtype.h>
+#include <emu/EmuStructs.h>
+#include <emu/Resampler.h>
+
+#include <cstdint>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Thin wrapper around a libvgm sound device.@n
+   The device runs at its native rate and is resampled to the host rate by libvgm's own resampler.
+   start() and stop() allocate and must not be called from the audio thread, everything else is realtime-safe.@n
+   A suspended chip keeps its state but is not rendered, the next register write resumes it.
+ */
+class VgmChip
+{
+public:
+    VgmChip();
+    ~VgmChip();
+
+    bool start(uint8_t deviceId, uint32_t clock, uint32_t sampleRate, uint32_t emuCore = 0);
+    void stop();
+    void reset();
+
+    bool isRunning() const noexcept
+    {
+        return fRunning;
+    }
+
+    void suspend() noexcept
+    {
+        fSuspended = true;
+    }
+
+    bool isSuspended() const noexcept
+    {
+        return fSuspended;
+    }
+
+    /**
+       Write @a data to register @a reg through the address/data port pair @a port.
+       This is the OPN/OPM convention, port 0 is at offsets 0/1, port 1 at offsets 2/3.
+     */
+    void write(uint8_t port, uint8_t reg, uint8_t data) noexcept
+    {
+        fSuspended = false;
+        fWrite(fDevInfo.dataPtr, port << 1, reg);
+        fWrite(fDevInfo.dataPtr, (port << 1) | 1, data);
+    }
+
+    /**
+       Write a single byte at device offset @a offset, for chips without an address latch (e.g. SN76489).
+     */
+    void writeDirect(uint8_t offset, uint8_t data) noexcept
+    {
+        fSuspended = false;
+        fWrite(fDevInfo.dataPtr, offset, data);
+    }
+
+    /**
+       Render @a frames frames at the host rate and add them to @a buffer.
+       Samples are 24-bit in a 32-bit container, as everywhere in libvgm.
+     */
+    void render(uint32_t frames, WAVE_32BS* buffer) noexcept
+    {
+        Resmpl_Execute(&fResampler, frames, buffer);
+    }
+
+private:
+    DEV_INFO fDevInfo;
+    RESMPL_STATE fResampler;
+    DEVFUNC_WRITE_A8D8 fWrite;
+    bool fRunning;
+    bool fSuspended;
+
+    VgmChip(const VgmChip&) = delete;
+    VgmChip& operator=(const VgmChip&) = delete;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,282 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "VoiceAllocator.hpp"
+
+// --------------------------------------------------------------------------------------------------------------------
+
+VoiceAllocator::VoiceAllocator()
+    : fClock(0),
+      fMultiTimbral(false),
+      fMpe(false)
+{
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+        fRoutes[c] = defaultChannelRoute(c);
+
+    fSingleRoute.firstVoice = 0;
+    fSingleRoute.voiceCount = kMaxVoices / kMaxChips;
+
+    setMpeMembers(kMpeMaxMembers);
+    reset();
+}
+
+void VoiceAllocator::reset() noexcept
+{
+    for (Voice& voice : fVoices)
+        voice = Voice();
+
+    for (VoiceMask& mask : fChannelVoices)
+        mask = 0;
+
+    fClock = 0;
+    fHeld = fSustained = fSostenuto = 0;
+    fSustainPedal = fSostenutoPedal = 0;
+}
+
+VoiceMask VoiceAllocator::getRoutableVoices() const noexcept
+{
+    ChannelRoute mpeZone;
+    mpeZone.voiceCount = kMpeMaxMembers;
+
+    VoiceMask voices = sliceMask(fSingleRoute) | sliceMask(mpeZone);
+
+    for (const ChannelRoute& route : fRoutes)
+        voices |= sliceMask(route);
+
+    return voices;
+}
+
+void VoiceAllocator::setMpeMembers(uint8_t count) noexcept
+{
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        ChannelRoute& route = fMpeRoutes[c];
+        const bool member = c != 0 && c <= count;
+
+        route.firstVoice = member ? c - 1 : 0;
+        route.voiceCount = member ? 1 : 0;
+    }
+}
+
+uint32_t VoiceAllocator::oldestVoice(VoiceMask mask) const noexcept
+{
+    uint32_t oldest = lowestVoice(mask);
+
+    for (mask &= mask - 1; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t v = lowestVoice(mask);
+
+        if (fVoices[v].age < fVoices[oldest].age)
+            oldest = v;
+    }
+
+    return oldest;
+}
+
+int VoiceAllocator::allocate(uint8_t channel, uint8_t note) noexcept
+{
+    const VoiceMask slice = sliceMask(getRoute(channel));
+
+    if (slice == 0)
+        return -1;
+
+    uint32_t index = kMaxVoices;
+
+    // a note struck again while the pedal keeps it sounding retriggers the same voice
+    for (VoiceMask mask = fSustained & fChannelVoices[channel]; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t v = lowestVoice(mask);
+
+        if (fVoices[v].note == note)
+        {
+            index = v;
+            break;
+        }
+    }
+
+    if (index == kMaxVoices)
+    {
+        const VoiceMask free = slice & ~(fHeld | fSustained);
+        const VoiceMask sustained = slice & fSustained;
+
+        index = oldestVoice(free != 0 ? free : sustained != 0 ? sustained : slice);
+    }
+
+    Voice& voice = fVoices[index];
+    const VoiceMask bit = 1u << index;
+
+    fChannelVoices[voice.channel] &= ~bit;
+    fChannelVoices[channel] |= bit;
+    fHeld |= bit;
+    fSustained &= ~bit;
+    fSostenuto &= ~bit;
+
+    voice.note = static_cast<int8_t>(note & 0x7F);
+    voice.channel = channel;
+    voice.age = ++fClock;
+    return static_cast<int>(index);
+}
+
+int VoiceAllocator::legato(uint8_t channel, uint8_t note) noexcept
+{
+    const VoiceMask held = fHeld & fChannelVoices[channel];
+
+    if (held == 0)
+        return -1;
+
+    // most recent held voice
+    uint32_t index = lowestVoice(held);
+
+    for (VoiceMask mask = held & (held - 1); mask != 0; mask &= mask - 1)
+    {
+        const uint32_t v = lowestVoice(mask);
+
+        if (fVoices[v].age > fVoices[index].age)
+            index = v;
+    }
+
+    Voice& voice = fVoices[index];
+    voice.note = static_cast<int8_t>(note & 0x7F);
+    voice.age = ++fClock;
+    return static_cast<int>(index);
+}
+
+int VoiceAllocator::noteOff(uint8_t channel, uint8_t note) noexcept
+{
+    for (VoiceMask mask = fHeld & fChannelVoices[channel]; mask != 0; mask &= mask - 1)
+    {
+        const uint32_t v = lowestVoice(mask);
+
+        if (fVoices[v].note != note)
+            continue;
+
+        const VoiceMask bit = 1u << v;
+        fHeld &= ~bit;
+
+        if ((fSustainPedal & (1 << channel)) != 0 || (fSostenuto & bit) != 0)
+        {
+            fSustained |= bit;
+            return -1;
+        }
+
+        release(bit);
+        return static_cast<int>(v);
+    }
+
+    return -1;
+}
+
+VoiceMask VoiceAllocator::setSustain(uint16_t channels, bool down) noexcept
+{
+    if (down)
+    {
+        fSustainPedal |= channels;
+        return 0;
+    }
+
+    fSustainPedal &= ~channels;
+
+    VoiceMask voices = 0;
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        if ((channels & (1 << c)) != 0)
+            voices |= fChannelVoices[c];
+    }
+
+    // voices latched by sostenuto stay until that pedal goes up
+    const VoiceMask released = fSustained & voices & ~fSostenuto;
+    release(released);
+    return released;
+}
+
+VoiceMask VoiceAllocator::setSostenuto(uint16_t channels, bool down) noexcept
+{
+    VoiceMask voices = 0;
+    uint16_t sustainedChannels = 0;
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        if ((channels & (1 << c)) == 0)
+            continue;
+
+        voices |= fChannelVoices[c];
+
+        if ((fSustainPedal & (1 << c)) != 0)
+            sustainedChannels |= 1 << c;
+    }
+
+    if (down)
+    {
+        // only notes held when the pedal goes down are latched, repeated pedal-down messages do not add more
+        const uint16_t newChannels = channels & ~fSostenutoPedal;
+        fSostenutoPedal |= channels;
+
+        VoiceMask latch = 0;
+        for (uint8_t c = 0; c < kMidiChannels; ++c)
+        {
+            if ((newChannels & (1 << c)) != 0)
+                latch |= fChannelVoices[c];
+        }
+
+        fSostenuto |= latch & fHeld;
+        return 0;
+    }
+
+    fSostenutoPedal &= ~channels;
+
+    const VoiceMask unlatched = fSostenuto & voices;
+    fSostenuto &= ~unlatched;
+
+    // notes already released are let go, unless the sustain pedal of their channel is down
+    VoiceMask kept = 0;
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        if ((sustainedChannels & (1 << c)) != 0)
+            kept |= fChannelVoices[c];
+    }
+
+    const VoiceMask released = unlatched & fSustained & ~kept;
+    release(released);
+    return released;
+}
+
+VoiceMask VoiceAllocator::releaseChannel(uint8_t channel) noexcept
+{
+    const VoiceMask released = fChannelVoices[channel & 0x0F];
+    release(released);
+    return released;
+}
+
+VoiceMask VoiceAllocator::releaseAll() noexcept
+{
+    const VoiceMask released = fHeld | fSustained;
+    release(released);
+    return released;
+}
+
+void VoiceAllocator::release(VoiceMask mask) noexcept
+{
+    fHeld &= ~mask;
+    fSustained &= ~mask;
+    fSostenuto &= ~mask;
+
+    for (VoiceMask& channelVoices : fChannelVoices)
+        channelVoices &= ~mask;
+
+    for (; mask != 0; mask &= mask - 1)
+    {
+        Voice& voice = fVoices[lowestVoice(mask)];
+        voice.note = -1;
+        voice.age = ++fClock;
+    }
+}
+
+void VoiceAllocator::invalidateImages() noexcept
+{
+    for (Voice& voice : fVoices)
+        voice.image = nullptr;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
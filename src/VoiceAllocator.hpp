@@ -0,0 +1,205 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "Routing.hpp"
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+struct FmRegisterImage;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   One bit per voice of the pool.
+ */
+typedef uint32_t VoiceMask;
+
+static_assert(kMaxVoices <= 32, "VoiceMask is too small for the voice pool");
+
+/**
+   Index of the lowest set bit of @a mask, which must not be 0.
+ */
+static inline uint32_t lowestVoice(VoiceMask mask) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+struct Voice {
+    int8_t note = -1;     // sounding note, held or kept by a pedal, -1 once released
+    uint8_t channel = 0;  // MIDI channel that last used the voice
+    uint8_t velocity = 0; // velocity of the last note-on
+    const FmRegisterImage* image = nullptr; // patch currently written to the chip channel, null if unknown
+    uint32_t age = 0;     // allocator clock at the last note-on or note-off
+};
+
+/**
+   Assigns chip voices to MIDI notes.@n
+   In single-timbral mode every MIDI channel shares the voices of the first chip.
+   In multi-timbral mode each MIDI channel has its own slice of the voice pool, set by the routing table.
+   In MPE mode (lower zone) member channel @a c is bound to voice @a c - 1, the master channel plays no notes.
+   Within a slice the voice released the longest ago is reused first, then the oldest one kept by a pedal,
+   then the oldest held one is stolen.@n
+   Voice states are kept as bitsets, so pedal changes resolve to a mask of voices to release without searching.
+   Functions returning a mask or voice index leave the chip writes to the caller.
+ */
+class VoiceAllocator
+{
+public:
+    VoiceAllocator();
+
+    void reset() noexcept;
+
+    void setMultiTimbral(bool multiTimbral) noexcept
+    {
+        fMultiTimbral = multiTimbral;
+    }
+
+    bool isMultiTimbral() const noexcept
+    {
+        return fMultiTimbral;
+    }
+
+    void setMpe(bool mpe) noexcept
+    {
+        fMpe = mpe;
+    }
+
+    bool isMpe() const noexcept
+    {
+        return fMpe;
+    }
+
+   /**
+      Number of MPE member channels following the master channel, from the MPE configuration message.
+    */
+    void setMpeMembers(uint8_t count) noexcept;
+
+    void setRoute(uint8_t channel, const ChannelRoute& route) noexcept
+    {
+        fRoutes[channel & 0x0F] = route;
+    }
+
+   /**
+      Route in effect for @a channel in the current mode.
+    */
+    const ChannelRoute& getRoute(uint8_t channel) const noexcept
+    {
+        return fMpe ? fMpeRoutes[channel & 0x0F] : fMultiTimbral ? fRoutes[channel & 0x0F] : fSingleRoute;
+    }
+
+    const ChannelRoute* getRoutingTable() const noexcept
+    {
+        return fRoutes;
+    }
+
+    Voice& getVoice(uint32_t index) noexcept
+    {
+        return fVoices[index];
+    }
+
+   /**
+      Voices any mode can allocate from with the current routing table,
+      MPE counts with the largest zone since its configuration may change from MIDI.
+    */
+    VoiceMask getRoutableVoices() const noexcept;
+
+   /**
+      Voices sounding a note, held or kept by a pedal.
+    */
+    VoiceMask getActiveVoices() const noexcept
+    {
+        return fHeld | fSustained;
+    }
+
+   /**
+      Voices sounding a note of @a channel, held or kept by a pedal.
+    */
+    VoiceMask getChannelVoices(uint8_t channel) const noexcept
+    {
+        return fChannelVoices[channel & 0x0F];
+    }
+
+   /**
+      Pick a voice for a new note on @a channel and mark it as held.
+      A voice kept by a pedal on the same note is reused.
+      Returns the voice index, or -1 when the channel has no voices routed to it.
+    */
+    int allocate(uint8_t channel, uint8_t note) noexcept;
+
+   /**
+      Most recent held voice of @a channel for a legato transition to @a note, or -1.
+      The voice is retargeted to @a note and stays keyed on.
+    */
+    int legato(uint8_t channel, uint8_t note) noexcept;
+
+   /**
+      Key released: returns the voice to key off, or -1 when none holds the note or a pedal keeps it sounding.
+    */
+    int noteOff(uint8_t channel, uint8_t note) noexcept;
+
+   /**
+      Sustain pedal of @a channels (one bit per MIDI channel) going up or down.
+      Returns the voices to key off.
+    */
+    VoiceMask setSustain(uint16_t channels, bool down) noexcept;
+
+   /**
+      Sostenuto pedal of @a channels going up or down, down latches the currently held voices.
+      Returns the voices to key off.
+    */
+    VoiceMask setSostenuto(uint16_t channels, bool down) noexcept;
+
+   /**
+      Release every voice of @a channel regardless of pedals, returns the voices to key off.
+    */
+    VoiceMask releaseChannel(uint8_t channel) noexcept;
+
+   /**
+      Release every voice regardless of pedals, returns the voices to key off.
+    */
+    VoiceMask releaseAll() noexcept;
+
+   /**
+      Forget which patches are loaded on the chips, e.g. after the library changed.
+    */
+    void invalidateImages() noexcept;
+
+private:
+    void release(VoiceMask mask) noexcept;
+
+    VoiceMask sliceMask(const ChannelRoute& route) const noexcept
+    {
+        return route.voiceCount == 0 ? 0 : static_cast<VoiceMask>(((1ull << route.voiceCount) - 1) << route.firstVoice);
+    }
+
+    uint32_t oldestVoice(VoiceMask mask) const noexcept;
+
+    Voice fVoices[kMaxVoices];
+    ChannelRoute fRoutes[kMidiChannels];
+    ChannelRoute fSingleRoute;
+    ChannelRoute fMpeRoutes[kMidiChannels];
+    uint32_t fClock;
+    bool fMultiTimbral;
+    bool fMpe;
+
+    VoiceMask fHeld;      // key down
+    VoiceMask fSustained; // key up, kept sounding by a pedal
+    VoiceMask fSostenuto; // latched by the sostenuto pedal
+    VoiceMask fChannelVoices[kMidiChannels];
+    uint16_t fSustainPedal;   // one bit per MIDI channel
+    uint16_t fSostenutoPedal; // one bit per MIDI channel
+};
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,176 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "WorkerPool.hpp"
+#include "RealtimeCheck.hpp"
+#include "Tracer.hpp"
+
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+#endif
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static inline void cpuRelax() noexcept
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+WorkerPool::WorkerPool()
+    : fWorkers(),
+      fWorkerCount(0),
+      fWake(0),
+      fSleeping(0),
+      fFunction(nullptr),
+      fContext(nullptr),
+      fGeneration(0),
+      fWork(0),
+      fCount(0),
+      fDone(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+uint32_t WorkerPool::start(uint32_t workers)
+{
+    stop();
+
+    // the barrier spins on workers which are not running when the cores are oversubscribed, 0 is unknown
+    const uint32_t cores = std::thread::hardware_concurrency();
+
+    if (cores != 0)
+        workers = std::min(workers, cores - 1);
+
+    for (uint32_t w = 0; w < std::min(workers, kMaxWorkers); ++w)
+    {
+        Worker* const worker = new Worker(*this);
+
+        if (! worker->startThread(true))
+        {
+            delete worker;
+            break;
+        }
+
+        fWorkers[fWorkerCount++] = worker;
+    }
+
+    return fWorkerCount;
+}
+
+void WorkerPool::stop()
+{
+    for (uint32_t w = 0; w < fWorkerCount; ++w)
+        fWorkers[w]->signalThreadShouldExit();
+
+    for (uint32_t w = 0; w < fWorkerCount; ++w)
+        fWake.post();
+
+    for (uint32_t w = 0; w < fWorkerCount; ++w)
+    {
+        fWorkers[w]->stopThread(-1);
+        delete fWorkers[w];
+        fWorkers[w] = nullptr;
+    }
+
+    fWorkerCount = 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+void WorkerPool::dispatch(Function function, void* context, uint32_t count) noexcept
+{
+    if (fWorkerCount == 0 || count < 2)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+            function(context, i);
+        return;
+    }
+
+    fFunction = function;
+    fContext = context;
+    fCount.store(count, std::memory_order_relaxed);
+    fDone.store(0, std::memory_order_relaxed);
+
+    // sequentially consistent against the sleeping count, a worker either sees the batch or gets woken
+    fWork.store(static_cast<uint64_t>(++fGeneration) << 32);
+
+    for (uint32_t s = std::min(fSleeping.load(), count - 1); s > 0; --s)
+        fWake.post();
+
+    runJobs(fGeneration);
+
+    // barrier, the last jobs may still be running on the workers
+    while (fDone.load(std::memory_order_acquire) < count)
+        cpuRelax();
+}
+
+void WorkerPool::runJobs(uint32_t generation) noexcept
+{
+    uint64_t work = fWork.load(std::memory_order_acquire);
+
+    while (generationOf(work) == generation && static_cast<uint32_t>(work) < fCount.load(std::memory_order_relaxed))
+    {
+        if (! fWork.compare_exchange_weak(work, work + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            continue;
+
+        // the batch cannot end before this job is done, its function and context stay valid
+        fFunction(fContext, static_cast<uint32_t>(work));
+        fDone.fetch_add(1, std::memory_order_release);
+
+        work = fWork.load(std::memory_order_acquire);
+    }
+}
+
+void WorkerPool::work(Worker& worker) noexcept
+{
+    VGM_TRACE_THREAD("Render worker");
+
+    uint32_t seen = generationOf(fWork.load(std::memory_order_acquire));
+
+    while (! worker.shouldThreadExit())
+    {
+        uint32_t generation = seen;
+
+        for (uint32_t i = 0; i < kSpinCount && generation == seen; ++i)
+        {
+            cpuRelax();
+            generation = generationOf(fWork.load(std::memory_order_acquire));
+        }
+
+        if (generation == seen)
+        {
+            fSleeping.fetch_add(1);
+
+            if (generationOf(fWork.load()) == seen)
+                fWake.wait();
+
+            fSleeping.fetch_sub(1);
+            continue;
+        }
+
+        seen = generation;
+
+        VGM_REALTIME_SCOPE("WorkerPool jobs");
+        runJobs(seen);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,94 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "DistrhoUtils.hpp"
+#include "extra/Semaphore.hpp"
+#include "extra/Thread.hpp"
+
+#include "JobDispatcher.hpp"
+#include "Routing.hpp"
+
+#include <atomic>
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Realtime-priority threads of a single plugin instance sharing the chips of each quantum with the rendering thread.@n
+   Jobs are claimed from a shared counter and the rendering thread waits for the last one on a spinning barrier,
+   no lock is taken. Idle workers spin for a short while, so the quanta of a host block go back to back,
+   then sleep until the next dispatch.@n
+   start() and stop() are non-realtime.
+ */
+class WorkerPool : public JobDispatcher
+{
+public:
+    // the rendering thread takes part, one worker less than the chips of the pool is enough
+    static constexpr const uint32_t kMaxWorkers = kMaxChips - 1;
+    static constexpr const uint32_t kSpinCount = 4096;
+
+    WorkerPool();
+    ~WorkerPool() override;
+
+   /**
+      Start up to @a workers threads, no more than the CPU cores besides the rendering thread.@n
+      Returns the number started.
+    */
+    uint32_t start(uint32_t workers);
+    void stop();
+
+    uint32_t getWorkerCount() const noexcept
+    {
+        return fWorkerCount;
+    }
+
+    void dispatch(Function function, void* context, uint32_t count) noexcept override;
+
+private:
+    class Worker : public Thread
+    {
+    public:
+        Worker(WorkerPool& pool)
+            : Thread("WorkerPool"),
+              fPool(pool) {}
+
+    protected:
+        void run() override
+        {
+            fPool.work(*this);
+        }
+
+    private:
+        WorkerPool& fPool;
+    };
+
+    void work(Worker& worker) noexcept;
+    void runJobs(uint32_t generation) noexcept;
+
+    static uint32_t generationOf(uint64_t work) noexcept
+    {
+        return static_cast<uint32_t>(work >> 32);
+    }
+
+    Worker* fWorkers[kMaxWorkers];
+    uint32_t fWorkerCount;
+    Semaphore fWake;
+    std::atomic<uint32_t> fSleeping;
+
+    // current batch, fFunction and fContext only change while no job is left to claim
+    JobDispatcher::Function fFunction;
+    void* fContext;
+    uint32_t fGeneration;
+    std::atomic<uint64_t> fWork; // generation << 32 | next job index
+    std::atomic<uint32_t> fCount;
+    std::atomic<uint32_t> fDone;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,408 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+// Golden-output regression test, renders the fixtures through every YM2612 core and compares them to stored hashes.
+
+#include "DspKernels.hpp"
+#include "FmPatch.hpp"
+#include "MidiFile.hpp"
+#include "SynthEngine.hpp"
+
+#include <emu/EmuCores.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+enum FixtureMode {
+    kModeDefault,
+    kModeMultiTimbral,
+    kModeMpe
+};
+
+struct Fixture {
+    const char* midiFile;
+    const char* bankFile; // nullptr for the built-in patch
+    FixtureMode mode;
+};
+
+static const Fixture kFixtures[] = {
+    { "scale.mid", nullptr, kModeDefault },          // one voice at a time, velocity and pitch bend
+    { "chords.mid", "bank.json", kModeDefault },     // sustain pedal over more than one chip, patch crossfade
+    { "multi.mid", "bank.json", kModeMultiTimbral }, // four channels with their own programs
+    { "mpe.mid", "bank.json", kModeMpe },            // member channel and master channel bends
+};
+
+struct Core {
+    const char* name;
+    uint32_t fcc;
+};
+
+static const Core kCores[] = {
+    { "mame", FCC_MAME },
+    { "nuked", FCC_NUKE },
+    { "gpgx", FCC_GPGX },
+};
+
+static const double kSampleRates[] = { 44100.0, 48000.0, 96000.0 };
+
+// below, equal to and above the engine quantum, and not a multiple of it
+static const uint32_t kBufferSizes[] = { 16, 64, 100, 1024 };
+
+static constexpr const float kTailTime = 1.0f; // seconds rendered after the last event
+
+struct Options {
+    std::string fixtureDir = ".";
+    std::string referenceDir = "golden";
+    std::string referenceFile; // <referenceDir>/<SIMD flavour>.txt if empty
+    std::string wavDir;
+    bool update = false;
+};
+
+static void usage(const char* name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  -f, --fixtures DIR   directory of the MIDI files and banks (.)\n"
+                 "  -d, --references DIR stored hashes, one file per SIMD flavour of the kernels (golden)\n"
+                 "  -r, --reference FILE stored hashes, instead of the file of this build in the references\n"
+                 "  -u, --update         write the hashes of this build to the reference file\n"
+                 "  -w, --wav DIR        also write every rendering as a 32-bit float WAV file\n",
+                 name);
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if ((std::strcmp(arg, "-f") == 0 || std::strcmp(arg, "--fixtures") == 0) && hasValue)
+            options.fixtureDir = argv[++i];
+        else if ((std::strcmp(arg, "-r") == 0 || std::strcmp(arg, "--reference") == 0) && hasValue)
+            options.referenceFile = argv[++i];
+        else if ((std::strcmp(arg, "-d") == 0 || std::strcmp(arg, "--references") == 0) && hasValue)
+            options.referenceDir = argv[++i];
+        else if (std::strcmp(arg, "-u") == 0 || std::strcmp(arg, "--update") == 0)
+            options.update = true;
+        else if ((std::strcmp(arg, "-w") == 0 || std::strcmp(arg, "--wav") == 0) && hasValue)
+            options.wavDir = argv[++i];
+        else
+            return false;
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   FNV-1a over the bit patterns of the samples, any difference in the output changes it.
+ */
+class OutputHash
+{
+public:
+    void add(const float* samples, uint32_t count) noexcept
+    {
+        const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(samples);
+
+        for (size_t i = 0; i < count * sizeof(float); ++i)
+            fHash = (fHash ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    uint64_t get() const noexcept
+    {
+        return fHash;
+    }
+
+private:
+    uint64_t fHash = 0xCBF29CE484222325ull;
+};
+
+static bool writeWav(const std::string& filename, const std::vector<float>& interleaved, double sampleRate)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (! file.is_open())
+        return false;
+
+    const auto u16 = [&file](uint16_t v) { file.put(static_cast<char>(v & 0xFF)).put(static_cast<char>(v >> 8)); };
+    const auto u32 = [&u16](uint32_t v) { u16(v & 0xFFFF); u16(v >> 16); };
+    const uint32_t dataSize = static_cast<uint32_t>(interleaved.size() * sizeof(float));
+    const uint32_t rate = static_cast<uint32_t>(sampleRate);
+
+    file.write("RIFF", 4);
+    u32(36 + dataSize);
+    file.write("WAVEfmt ", 8);
+    u32(16);
+    u16(3); // IEEE float
+    u16(2);
+    u32(rate);
+    u32(rate * 2 * sizeof(float));
+    u16(2 * sizeof(float));
+    u16(32);
+    file.write("data", 4);
+    u32(dataSize);
+    file.write(reinterpret_cast<const char*>(interleaved.data()), dataSize);
+
+    return file.good();
+}
+
+/**
+   Render @a events in host blocks of @a blockSize frames, events at their frame offset as in the plugin run().
+ */
+static uint64_t renderFixture(SynthEngine& engine, const std::vector<TimedMidiEvent>& events,
+                              double sampleRate, uint32_t blockSize, std::vector<float>* interleaved)
+{
+    const uint64_t songFrames = (events.empty() ? 0 : events.back().frame)
+                              + static_cast<uint64_t>(kTailTime * sampleRate);
+    std::vector<float> outL(blockSize), outR(blockSize);
+    OutputHash hash;
+    size_t next = 0;
+
+    engine.activate();
+
+    for (uint64_t blockStart = 0; blockStart < songFrames; blockStart += blockSize)
+    {
+        const uint32_t frames = static_cast<uint32_t>(std::min<uint64_t>(blockSize, songFrames - blockStart));
+        uint32_t done = 0;
+
+        for (; next < events.size() && events[next].frame < blockStart + frames; ++next)
+        {
+            const uint32_t frame = static_cast<uint32_t>(std::max(events[next].frame, blockStart) - blockStart);
+
+            if (frame > done)
+            {
+                engine.render(outL.data() + done, outR.data() + done, frame - done);
+                done = frame;
+            }
+
+            engine.handleMidi(events[next].data, events[next].size);
+        }
+
+        if (done < frames)
+            engine.render(outL.data() + done, outR.data() + done, frames - done);
+
+        // hashed frame by frame, so that the block boundaries don't change the hash
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            const float frame[2] = { outL[i], outR[i] };
+            hash.add(frame, 2);
+
+            if (interleaved != nullptr)
+                interleaved->insert(interleaved->end(), frame, frame + 2);
+        }
+    }
+
+    engine.deactivate();
+
+    return hash.get();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static std::string caseName(const Fixture& fixture, const Core& core, double sampleRate)
+{
+    char name[128];
+    std::snprintf(name, sizeof(name), "%s %s %.0f", fixture.midiFile, core.name, sampleRate);
+    return name;
+}
+
+static void loadReference(const std::string& filename, std::map<std::string, uint64_t>& hashes)
+{
+    std::ifstream file(filename);
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // "<fixture> <core> <rate> <hash>", the hash in hex
+        const size_t split = line.find_last_of(' ');
+        if (split == std::string::npos)
+            continue;
+
+        hashes[line.substr(0, split)] = std::stoull(line.substr(split + 1), nullptr, 16);
+    }
+}
+
+static bool writeReference(const std::string& filename, const std::map<std::string, uint64_t>& hashes)
+{
+    std::ofstream file(filename);
+    if (! file.is_open())
+        return false;
+
+    file << "# Output hashes of the golden test for " << simdName() << " kernels, written by vgm-golden-test --update\n"
+            "# <fixture> <core> <sample rate> <FNV-1a of the float samples>, the same for every buffer size\n";
+
+    for (const auto& entry : hashes)
+    {
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016" PRIx64, entry.second);
+        file << entry.first << ' ' << hash << '\n';
+    }
+
+    return file.good();
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the kernels round differently with each instruction set, each has hashes of its own
+    if (options.referenceFile.empty())
+        options.referenceFile = options.referenceDir + "/" + simdName() + ".txt";
+
+    std::map<std::string, uint64_t> reference, rendered;
+
+    if (! options.update)
+        loadReference(options.referenceFile, reference);
+
+    uint32_t failures = 0;
+    uint32_t missing = 0;
+
+    for (const Fixture& fixture : kFixtures)
+    {
+        PatchLibrary library;
+        std::string error;
+
+        if (fixture.bankFile != nullptr
+            && ! loadPatchLibrary((options.fixtureDir + "/" + fixture.bankFile).c_str(), library, error))
+        {
+            std::fprintf(stderr, "FAIL %s: cannot load bank %s: %s\n", fixture.midiFile, fixture.bankFile,
+                         error.c_str());
+            ++failures;
+            continue;
+        }
+
+        for (const double sampleRate : kSampleRates)
+        {
+            std::vector<TimedMidiEvent> events;
+
+            if (! loadMidiFile((options.fixtureDir + "/" + fixture.midiFile).c_str(), sampleRate, events, error))
+            {
+                std::fprintf(stderr, "FAIL %s: %s\n", fixture.midiFile, error.c_str());
+                ++failures;
+                break;
+            }
+
+            for (const Core& core : kCores)
+            {
+                const std::string name = caseName(fixture, core, sampleRate);
+                bool consistent = true;
+                uint64_t first = 0;
+
+                for (const uint32_t blockSize : kBufferSizes)
+                {
+                    // a fresh engine per rendering, nothing carries over from the previous one
+                    SynthEngine engine;
+                    engine.setSampleRate(sampleRate);
+                    engine.setEmuCore(core.fcc);
+                    engine.setMultiTimbral(fixture.mode == kModeMultiTimbral);
+                    engine.setMpe(fixture.mode == kModeMpe);
+
+                    if (fixture.bankFile != nullptr)
+                    {
+                        PatchLibrary copy = library;
+                        engine.setLibrary(copy);
+                    }
+
+                    const bool writeFile = ! options.wavDir.empty() && blockSize == kBufferSizes[0];
+                    std::vector<float> interleaved;
+                    const uint64_t hash = renderFixture(engine, events, sampleRate, blockSize,
+                                                        writeFile ? &interleaved : nullptr);
+
+                    if (writeFile)
+                    {
+                        std::string wavName = name;
+                        std::replace(wavName.begin(), wavName.end(), ' ', '-');
+
+                        if (! writeWav(options.wavDir + "/" + wavName + ".wav", interleaved, sampleRate))
+                            std::fprintf(stderr, "cannot write %s.wav\n", wavName.c_str());
+                    }
+
+                    // the block size only changes where the host splits the output, never the output itself
+                    if (blockSize == kBufferSizes[0])
+                        first = hash;
+                    else if (hash != first)
+                    {
+                        std::fprintf(stderr, "FAIL %s: %u frame blocks render differently from %u frame blocks\n",
+                                     name.c_str(), blockSize, kBufferSizes[0]);
+                        consistent = false;
+                    }
+                }
+
+                rendered[name] = first;
+
+                if (! consistent)
+                {
+                    ++failures;
+                    continue;
+                }
+
+                if (options.update)
+                    continue;
+
+                const auto found = reference.find(name);
+
+                if (found == reference.end())
+                {
+                    std::fprintf(stderr, "FAIL %s: no recorded hash, rendered %016" PRIx64 "\n", name.c_str(),
+                                 first);
+                    ++missing;
+                }
+                else if (found->second != first)
+                {
+                    std::fprintf(stderr, "FAIL %s: hash %016" PRIx64 ", expected %016" PRIx64 "\n", name.c_str(),
+                                 first, found->second);
+                    ++failures;
+                }
+                else
+                    std::printf("ok   %s\n", name.c_str());
+            }
+        }
+    }
+
+    if (options.update)
+    {
+        if (failures != 0)
+        {
+            std::fprintf(stderr, "%u failures, reference not written\n", failures);
+            return 1;
+        }
+
+        if (! writeReference(options.referenceFile, rendered))
+        {
+            std::fprintf(stderr, "cannot write %s\n", options.referenceFile.c_str());
+            return 1;
+        }
+
+        std::printf("wrote %zu hashes to %s\n", rendered.size(), options.referenceFile.c_str());
+        return 0;
+    }
+
+    std::printf("%zu cases, %u failed, %u without reference\n", rendered.size(), failures, missing);
+
+    // a new fixture or core is not a pass until its hashes are recorded with --update
+    if (missing != 0)
+        std::printf("record the hashes of a trusted build with --update --reference %s\n",
+                    options.referenceFile.c_str());
+
+    return failures != 0 || missing != 0 ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+// Host simulation, drives the plugin through the framework exporter the way a plugin format does, with odd block
+// sizes, sample rate changes, dense MIDI, automation and state changes from other threads, and checks the output
+// and the time of every block.
+
+#include "DistrhoPluginInternal.hpp"
+
+#include "Parameters.hpp"
+#include "Routing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the Plugin implementation of the framework, which DistrhoPluginMain.cpp compiles into every plugin format
+#include "src/DistrhoPlugin.cpp"
+#include "src/DistrhoUtils.cpp"
+
+USE_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static const double kSampleRates[] = { 22050.0, 44100.0, 48000.0, 88200.0, 96000.0, 192000.0 };
+static const uint32_t kMaxBlockSizes[] = { 1, 16, 64, 100, 128, 256, 441, 512, 1024, 2048, 4096 };
+static const uint8_t kControllers[] = { 0, 1, 6, 7, 10, 11, 32, 38, 64, 66, 68, 74, 98, 99, 100, 101, 120, 121, 123 };
+
+static constexpr const uint32_t kMaxEventsPerBlock = 128;
+static constexpr const float kMaxSample = 100.0f;        // +40 dB, the output gain parameter tops at +30
+static constexpr const float kMaxLatencyTime = 0.200f;    // seconds, kMaxRenderAheadTime of the plugin
+static constexpr const uint32_t kMinBudgetFrames = 256;   // below this the fixed cost of a block dominates
+static constexpr const uint32_t kMaxReportedFailures = 10;
+
+struct Options {
+    double seconds = 10.0;
+    uint32_t seed = 0;
+    const char* bankFile = nullptr;
+    double maxOverrun = 4.0;     // blocks slower than this are reported
+    bool failOnOverrun = false;  // and fail the run, wall-clock times depend on the machine and its load
+};
+
+static void usage(const char* name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  -t, --seconds SECONDS  wall time of the run (10)\n"
+                 "  -s, --seed SEED        random seed, a random one if 0 (0)\n"
+                 "  -k, --bank FILE        patch bank the file state switches to\n"
+                 "  -o, --max-overrun X    fail when a block takes more than X times its real-time length,\n"
+                 "                         without it blocks over 4 times are only reported\n",
+                 name);
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if ((std::strcmp(arg, "-t") == 0 || std::strcmp(arg, "--seconds") == 0) && hasValue)
+            options.seconds = std::atof(argv[++i]);
+        else if ((std::strcmp(arg, "-s") == 0 || std::strcmp(arg, "--seed") == 0) && hasValue)
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if ((std::strcmp(arg, "-k") == 0 || std::strcmp(arg, "--bank") == 0) && hasValue)
+            options.bankFile = argv[++i];
+        else if ((std::strcmp(arg, "-o") == 0 || std::strcmp(arg, "--max-overrun") == 0) && hasValue)
+        {
+            options.maxOverrun = std::atof(argv[++i]);
+            options.failOnOverrun = true;
+        }
+        else
+            return false;
+    }
+
+    return options.seconds > 0.0 && options.maxOverrun > 0.0;
+}
+
+template <typename T, size_t N>
+static T pick(const T (&values)[N], std::mt19937& rng)
+{
+    return values[rng() % N];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+   Random channel messages, with a few of the messages the engine has to ignore.
+ */
+class MidiGenerator
+{
+public:
+    explicit MidiGenerator(uint32_t seed)
+        : fRng(seed) {}
+
+    void generate(MidiEvent& event, uint32_t frame)
+    {
+        const uint8_t channel = fRng() % kMidiChannels;
+        const uint32_t kind = fRng() % 100;
+
+        event = MidiEvent();
+        event.frame = frame;
+        event.size = 3;
+        event.data[1] = fRng() % 128;
+        event.data[2] = fRng() % 128;
+
+        if (kind < 40)
+        {
+            // velocity 0 is a note off
+            event.data[0] = 0x90 | channel;
+            event.data[1] = 24 + fRng() % 84;
+        }
+        else if (kind < 70)
+        {
+            event.data[0] = 0x80 | channel;
+            event.data[1] = 24 + fRng() % 84;
+        }
+        else if (kind < 80)
+        {
+            event.data[0] = 0xB0 | channel;
+            event.data[1] = pick(kControllers, fRng);
+        }
+        else if (kind < 88)
+            event.data[0] = 0xE0 | channel;
+        else if (kind < 92)
+        {
+            event.data[0] = 0xC0 | channel;
+            event.size = 2;
+        }
+        else if (kind < 95)
+        {
+            event.data[0] = (fRng() % 2 ? 0xD0 : 0xA0) | channel;
+            event.size = event.data[0] >= 0xD0 ? 2 : 3;
+        }
+        else if (kind < 98)
+        {
+            event.data[0] = 0xF8; // timing clock
+            event.size = 1;
+        }
+        else
+        {
+            // sysex, longer than the inline data
+            static const uint8_t kSysex[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+            event.size = sizeof(kSysex);
+            event.dataExt = kSysex;
+        }
+    }
+
+private:
+    std::mt19937 fRng;
+};
+
+static float randomParameterValue(PluginExporter& plugin, uint32_t index, std::mt19937& rng)
+{
+    const ParameterRanges& ranges = plugin.getParameterRanges(index);
+    const float span = ranges.max - ranges.min;
+    float value = ranges.min + span * std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+
+    // some hosts send values out of range
+    if (rng() % 20 == 0)
+        value += span * (rng() % 2 ? 0.5f : -0.5f);
+
+    if ((plugin.getParameterHints(index) & (kParameterIsInteger | kParameterIsBoolean)) != 0)
+        value = std::round(value);
+
+    return value;
+}
+
+static std::string randomRouting(std::mt19937& rng)
+{
+    ChannelRoute routes[kMidiChannels];
+
+    for (uint8_t c = 0; c < kMidiChannels; ++c)
+    {
+        routes[c].program = rng() % 128;
+        routes[c].firstVoice = rng() % kMaxVoices;
+        routes[c].voiceCount = rng() % (kMaxVoices - routes[c].firstVoice + 1);
+    }
+
+    return routingToString(routes);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Totals {
+    uint64_t sessions = 0;
+    uint64_t blocks = 0;
+    uint64_t frames = 0;
+    uint64_t events = 0;
+    uint64_t overruns = 0;
+    uint32_t failures = 0;
+    double audioTime = 0.0;
+    double renderTime = 0.0;
+    double worstLoad = 0.0;
+    std::atomic<uint64_t> parameterChanges { 0 };
+    std::atomic<uint64_t> outputReads { 0 };
+    std::atomic<uint64_t> badOutputs { 0 };
+    std::atomic<uint64_t> stateChanges { 0 };
+};
+
+class HostStress
+{
+public:
+    HostStress(const Options& options, uint32_t seed)
+        : fOptions(options),
+          fSeed(seed),
+          fPlugin(nullptr, nullptr, nullptr, nullptr),
+          fParameterCount(fPlugin.getParameterCount()) {}
+
+    int run()
+    {
+        std::thread automation(&HostStress::automate, this);
+        std::thread mainThread(&HostStress::changeStates, this);
+
+        process();
+
+        fStop.store(true);
+        automation.join();
+        mainThread.join();
+
+        std::printf("seed %u: %llu sessions, %llu blocks, %.1f s of audio rendered in %.1f s, %llu MIDI events, "
+                    "%llu parameter changes, %llu output parameter reads, %llu state changes\n",
+                    fSeed, ull(fTotals.sessions), ull(fTotals.blocks), fTotals.audioTime, fTotals.renderTime,
+                    ull(fTotals.events), ull(fTotals.parameterChanges.load()), ull(fTotals.outputReads.load()),
+                    ull(fTotals.stateChanges.load()));
+        std::printf("worst block at %.2f of its real-time length, %llu over %.1f\n", fTotals.worstLoad,
+                    ull(fTotals.overruns), fOptions.maxOverrun);
+
+        if (fTotals.failures != 0 || fTotals.badOutputs != 0 || (fOptions.failOnOverrun && fTotals.overruns != 0))
+        {
+            std::printf("FAILED, %u output failures, %llu non-finite output parameters, %llu slow blocks, "
+                        "rerun with --seed %u\n", fTotals.failures, ull(fTotals.badOutputs.load()),
+                        ull(fOptions.failOnOverrun ? fTotals.overruns : 0), fSeed);
+            return 1;
+        }
+
+        return 0;
+    }
+
+private:
+    static unsigned long long ull(uint64_t value)
+    {
+        return static_cast<unsigned long long>(value);
+    }
+
+    void fail(const char* format, double rate, uint32_t blockSize, uint64_t block, float value)
+    {
+        if (++fTotals.failures <= kMaxReportedFailures)
+        {
+            std::printf("FAIL session %llu (%.0f Hz, %u frames) block %llu: ", ull(fTotals.sessions), rate,
+                        blockSize, ull(block));
+            std::printf(format, value);
+            std::printf("\n");
+        }
+    }
+
+    /**
+       The audio thread, sessions of a random sample rate and maximum block size, random blocks inside.
+     */
+    void process()
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        std::mt19937 rng(fSeed);
+        MidiGenerator midi(fSeed + 1);
+        std::vector<MidiEvent> events(kMaxEventsPerBlock);
+        std::vector<std::vector<float>> buffers(DISTRHO_PLUGIN_NUM_OUTPUTS);
+        float* outputs[DISTRHO_PLUGIN_NUM_OUTPUTS];
+
+        const Clock::time_point end = Clock::now()
+                                    + std::chrono::duration_cast<Clock::duration>(
+                                          std::chrono::duration<double>(fOptions.seconds));
+
+        while (Clock::now() < end)
+        {
+            const double rate = pick(kSampleRates, rng);
+            const uint32_t blockSize = pick(kMaxBlockSizes, rng);
+            const uint64_t sessionFrames = static_cast<uint64_t>(rate * (0.1 + (rng() % 1400) / 1000.0));
+
+            for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; ++c)
+            {
+                buffers[c].resize(blockSize);
+                outputs[c] = buffers[c].data();
+            }
+
+            // sample rate and block size only change while the plugin is inactive
+            fPlugin.setSampleRate(rate, true);
+            fPlugin.setBufferSize(blockSize, true);
+            fPlugin.activate();
+
+            ++fTotals.sessions;
+
+            const uint32_t latency = fPlugin.getLatency();
+
+            if (latency > std::max<double>(rate * kMaxLatencyTime, 2.0 * blockSize))
+                fail("latency of %.0f frames", rate, blockSize, 0, latency);
+
+            for (uint64_t done = 0, block = 0; done < sessionFrames; ++block)
+            {
+                const uint32_t frames = rng() % 4 == 0 ? blockSize : rng() % (blockSize + 1);
+                uint32_t eventCount = 0;
+
+                // now and then a block as dense as a sequencer flushing its queue
+                if (frames != 0)
+                    eventCount = rng() % 16 == 0 ? rng() % (kMaxEventsPerBlock + 1) : rng() % 4;
+
+                for (uint32_t i = 0; i < eventCount; ++i)
+                    midi.generate(events[i], rng() % frames);
+
+                std::sort(events.begin(), events.begin() + eventCount,
+                          [](const MidiEvent& a, const MidiEvent& b) { return a.frame < b.frame; });
+
+                // garbage in the buffers, every frame must be written
+                for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; ++c)
+                    std::fill(buffers[c].begin(), buffers[c].end(), std::nanf(""));
+
+                const Clock::time_point start = Clock::now();
+
+                fPlugin.run(nullptr, outputs, frames, events.data(), eventCount);
+
+                const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                const double load = elapsed * rate / std::max(frames, kMinBudgetFrames);
+
+                fTotals.renderTime += elapsed;
+                fTotals.worstLoad = std::max(fTotals.worstLoad, load);
+
+                if (load > fOptions.maxOverrun && ++fTotals.overruns <= kMaxReportedFailures)
+                    std::printf("slow block, session %llu (%.0f Hz, %u frames) block %llu: %u frames, %u events, "
+                                "%.0f us\n", ull(fTotals.sessions), rate, blockSize, ull(block), frames, eventCount,
+                                elapsed * 1e6);
+
+                checkOutputs(outputs, frames, rate, blockSize, block);
+
+                done += frames;
+                fTotals.frames += frames;
+                fTotals.events += eventCount;
+                ++fTotals.blocks;
+            }
+
+            fTotals.audioTime += sessionFrames / rate;
+
+            fPlugin.deactivate();
+        }
+    }
+
+    void checkOutputs(float* const* outputs, uint32_t frames, double rate, uint32_t blockSize, uint64_t block)
+    {
+        for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; ++c)
+        {
+            for (uint32_t i = 0; i < frames; ++i)
+            {
+                const float sample = outputs[c][i];
+
+                if (! std::isfinite(sample))
+                {
+                    fail("sample %g, not written or not finite", rate, blockSize, block, sample);
+                    return;
+                }
+
+                if (std::abs(sample) > kMaxSample)
+                {
+                    fail("sample %g out of range", rate, blockSize, block, sample);
+                    return;
+                }
+            }
+        }
+    }
+
+    /**
+       Host automation from a thread of its own, as a VST3 controller or a state restore may do, concurrently with
+       run(), activate() and deactivate().
+     */
+    void automate()
+    {
+        std::mt19937 rng(fSeed + 2);
+
+        while (! fStop.load())
+        {
+            const uint32_t index = rng() % fParameterCount;
+
+            // output parameters are read from a host thread too, VST2 idle or the UI parameter sync
+            if (fPlugin.isParameterOutput(index))
+            {
+                if (! std::isfinite(fPlugin.getParameterValue(index)))
+                    ++fTotals.badOutputs;
+
+                ++fTotals.outputReads;
+                continue;
+            }
+
+            fPlugin.setParameterValue(index, randomParameterValue(fPlugin, index, rng));
+            ++fTotals.parameterChanges;
+
+            // bursts, with pauses long enough for the audio thread to render between them
+            if (rng() % 8 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 2000));
+            else if (rng() % 2 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    }
+
+    /**
+       The host main thread, states change while the audio thread runs, valid or not.
+     */
+    void changeStates()
+    {
+        std::mt19937 rng(fSeed + 3);
+        const std::string incidentFile = (std::filesystem::temp_directory_path() / "vgm-host-stress-incidents.json").string();
+
+        while (! fStop.load())
+        {
+            switch (rng() % 6) {
+              case 0:
+                fPlugin.setState("file", fOptions.bankFile != nullptr && rng() % 2 ? fOptions.bankFile : "");
+                break;
+              case 1:
+                fPlugin.setState("routing", rng() % 8 == 0 ? "" : rng() % 8 == 0 ? "garbage" : randomRouting(rng).c_str());
+                break;
+              case 2:
+                fPlugin.setState("renderahead", std::to_string(rng() % 3 == 0 ? 0 : rng() % 300).c_str());
+                break;
+              case 3:
+                fPlugin.setState("renderthreads", std::to_string(rng() % (kMaxChips + 2)).c_str());
+                break;
+              case 4:
+                fPlugin.setState("incidentthreshold", std::to_string(rng() % 200).c_str());
+                break;
+              case 5:
+                // reads the incident ring while the audio thread writes it
+                fPlugin.setState("incidentlog", incidentFile.c_str());
+                break;
+            }
+
+            ++fTotals.stateChanges;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1 + rng() % 30));
+        }
+    }
+
+    const Options& fOptions;
+    const uint32_t fSeed;
+    PluginExporter fPlugin;
+    const uint32_t fParameterCount;
+
+    std::atomic<bool> fStop { false };
+    Totals fTotals;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const uint32_t seed = options.seed != 0 ? options.seed : std::random_device()();
+
+    // read by the Plugin constructor, as the plugin formats set them
+    d_nextBufferSize = kMaxBlockSizes[0];
+    d_nextSampleRate = kSampleRates[0];
+
+    HostStress stress(options, seed);
+    return stress.run();
+}
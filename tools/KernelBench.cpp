@@ -0,0 +1,478 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+// Microbenchmarks of the rendering kernels, one at a time, with JSON results to compare builds or commits.
+
+#include "DspKernels.hpp"
+#include "FmPatch.hpp"
+#include "SynthEngine.hpp"
+#include "VgmChip.hpp"
+
+#include <emu/EmuCores.h>
+#include <emu/SoundDevs.h>
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// a quantum of the engine, a common host block, and a large one
+static const uint32_t kSizes[] = { 64, 256, 1024 };
+static constexpr const uint32_t kMaxSize = 1024;
+
+static constexpr const double kSampleRate = 48000.0;
+static constexpr const double kBatchTime = 0.002; // seconds, calls per batch are calibrated to about this
+static constexpr const size_t kMinBatches = 15;
+
+struct Core {
+    const char* name;
+    uint32_t fcc;
+};
+
+static const Core kCores[] = {
+    { "mame", FCC_MAME },
+    { "nuked", FCC_NUKE },
+    { "gpgx", FCC_GPGX },
+};
+
+struct Options {
+    const char* filter = nullptr;
+    const char* jsonFile = nullptr;
+    const char* baselineFile = nullptr;
+    double minTime = 0.25; // seconds per benchmark
+};
+
+static void usage(const char* name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  -f, --filter TEXT    only run the benchmarks whose name contains TEXT\n"
+                 "  -t, --time SECONDS   minimum time of each benchmark (0.25)\n"
+                 "  -j, --json FILE      write the results as JSON\n"
+                 "  -c, --compare FILE   print the change from the results of an earlier --json run\n",
+                 name);
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if ((std::strcmp(arg, "-f") == 0 || std::strcmp(arg, "--filter") == 0) && hasValue)
+            options.filter = argv[++i];
+        else if ((std::strcmp(arg, "-t") == 0 || std::strcmp(arg, "--time") == 0) && hasValue)
+            options.minTime = std::atof(argv[++i]);
+        else if ((std::strcmp(arg, "-j") == 0 || std::strcmp(arg, "--json") == 0) && hasValue)
+            options.jsonFile = argv[++i];
+        else if ((std::strcmp(arg, "-c") == 0 || std::strcmp(arg, "--compare") == 0) && hasValue)
+            options.baselineFile = argv[++i];
+        else
+            return false;
+    }
+
+    return options.minTime > 0.0;
+}
+
+/**
+   Make the compiler assume @a data is read and written, so the work producing it is not optimized away.
+ */
+static inline void keep(const void* data) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r"(data) : "memory");
+#else
+    static const void* volatile sink;
+    sink = data;
+#endif
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Result {
+    std::string name;
+    uint32_t frames;  // per call, items rather than frames for the lookups
+    double ns;        // per call, median of the batches
+    double nsMin;     // per call, fastest batch
+};
+
+/**
+   Times a benchmark in batches of calls, reports the median and the fastest batch.
+ */
+class Runner
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit Runner(const Options& options)
+        : fOptions(options) {}
+
+    template <typename Function>
+    void run(const std::string& name, uint32_t frames, Function&& function)
+    {
+        if (fOptions.filter != nullptr && name.find(fOptions.filter) == std::string::npos)
+            return;
+
+        // doubling until a batch is long enough also warms the caches and the branch predictors
+        uint64_t calls = 1;
+
+        while (batch(calls, function) < kBatchTime && calls < (1ull << 30))
+            calls *= 2;
+
+        std::vector<double> times;
+        const Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(fOptions.minTime));
+
+        while (times.size() < kMinBatches || Clock::now() < end)
+            times.push_back(batch(calls, function) * 1e9 / calls);
+
+        std::sort(times.begin(), times.end());
+
+        const Result result = { name, frames, times[times.size() / 2], times.front() };
+        fResults.push_back(result);
+
+        std::printf("%-32s %5u %12.1f ns %10.3f ns/frame %12.1f ns min\n", name.c_str(), frames, result.ns,
+                    result.ns / frames, result.nsMin);
+        std::fflush(stdout);
+    }
+
+    const std::vector<Result>& getResults() const noexcept
+    {
+        return fResults;
+    }
+
+private:
+    template <typename Function>
+    static double batch(uint64_t calls, Function& function)
+    {
+        const Clock::time_point start = Clock::now();
+
+        for (uint64_t i = 0; i < calls; ++i)
+            function();
+
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    const Options& fOptions;
+    std::vector<Result> fResults;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+// kernels of the mix and output stages, on noise
+
+static void fillNoise(float* buffer, uint32_t count, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    for (uint32_t i = 0; i < count; ++i)
+        buffer[i] = dist(rng);
+}
+
+static void benchGain(Runner& runner)
+{
+    std::mt19937 rng(1);
+    static float outL[kMaxSize], outR[kMaxSize], ramp[kMaxSize];
+    fillNoise(outL, kMaxSize, rng);
+    fillNoise(outR, kMaxSize, rng);
+
+    GainSmoother smoother;
+    smoother.setSampleRate(static_cast<float>(kSampleRate));
+    smoother.setTimeConstant(0.020f);
+
+    for (const uint32_t frames : kSizes)
+    {
+        // as applyOutputGain() while a gain change settles, the target flips so the ramp never does
+        runner.run("gain ramp", frames, [&] {
+            smoother.setTargetValue(smoother.getCurrentValue() < 0.5f ? 1.0f : 0.0f);
+            smoother.process(ramp, frames);
+            applyGainRamp(outL, ramp, frames);
+            applyGainRamp(outR, ramp, frames);
+            keep(outL);
+            keep(outR);
+        });
+
+        runner.run("gain constant", frames, [&] {
+            applyGain(outL, 0.999f, frames);
+            applyGain(outR, 1.001f, frames);
+            keep(outL);
+            keep(outR);
+        });
+    }
+}
+
+static void benchMixer(Runner& runner)
+{
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int32_t> dist(-0x7FFFFF, 0x7FFFFF);
+    static int32_t chip[kMaxSize * 2];
+    static float busL[kMaxSize], busR[kMaxSize], outL[kMaxSize], outR[kMaxSize];
+
+    for (int32_t& sample : chip)
+        sample = dist(rng);
+
+    fillNoise(busL, kMaxSize, rng);
+    fillNoise(busR, kMaxSize, rng);
+
+    BiquadCascade filter;
+    const BiquadCascade::Coefficients stages[2] = {
+        BiquadCascade::lowPass(3390.0f, 0.7071f, static_cast<float>(kSampleRate)),
+        BiquadCascade::highPass(20.0f, 0.7071f, static_cast<float>(kSampleRate)),
+    };
+    filter.setStages(stages, 2);
+
+    for (const uint32_t frames : kSizes)
+    {
+        // one chip into its bus, gain and pan ramping as after a mixer change
+        runner.run("mix chip ramp", frames, [&] {
+            std::memset(busL, 0, sizeof(float) * frames);
+            std::memset(busR, 0, sizeof(float) * frames);
+            mixStereoRamp(chip, busL, busR, 1e-7f, 1e-7f, 1e-12f, -1e-12f, frames);
+            keep(busL);
+            keep(busR);
+        });
+
+        runner.run("mix bus sum", frames, [&] {
+            addBuffer(outL, busL, frames);
+            addBuffer(outR, busR, frames);
+            keep(outL);
+            keep(outR);
+        });
+
+        // an output model with both stages on a stereo pair, and on two buses at once
+        runner.run("output filter 2ch", frames, [&] {
+            float* const channels[2] = { outL, outR };
+            filter.process(channels, 2, frames);
+            keep(outL);
+            keep(outR);
+        });
+
+        runner.run("output filter 4ch", frames, [&] {
+            float* const channels[4] = { outL, outR, busL, busR };
+            filter.process(channels, 4, frames);
+            keep(outL);
+            keep(busL);
+        });
+    }
+}
+
+static void benchPitch(Runner& runner)
+{
+    static uint16_t pitches[kMaxSize];
+
+    for (const uint32_t count : kSizes)
+    {
+        // notes over the keyboard with bends, as the control update for every voice
+        runner.run("note to block/fnum", count, [&] {
+            for (uint32_t i = 0; i < count; ++i)
+                pitches[i] = ym2612Pitch(24.0f + static_cast<float>(i % 96) + static_cast<float>(i % 7) * 0.13f);
+            keep(pitches);
+        });
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// libvgm resampling and the YM2612 cores
+
+static void nullUpdate(void*, UINT32 samples, DEV_SMPL** outputs)
+{
+    for (UINT32 i = 0; i < samples; ++i)
+    {
+        outputs[0][i] = static_cast<DEV_SMPL>(i * 4099) & 0xFFFF;
+        outputs[1][i] = static_cast<DEV_SMPL>(i * 7919) & 0xFFFF;
+    }
+}
+
+static void benchResampler(Runner& runner)
+{
+    // a device that costs next to nothing at the native YM2612 rate, leaving the resampler alone
+    DEV_DEF device;
+    std::memset(&device, 0, sizeof(device));
+    device.Update = nullUpdate;
+
+    DEV_INFO info;
+    std::memset(&info, 0, sizeof(info));
+    info.sampleRate = kYm2612Clock / 144;
+    info.devDef = &device;
+
+    static WAVE_32BS buffer[kMaxSize];
+    const uint32_t rates[] = { 44100, 48000, 96000 };
+
+    for (const uint32_t rate : rates)
+    {
+        RESMPL_STATE resampler;
+        std::memset(&resampler, 0, sizeof(resampler));
+        Resmpl_SetVals(&resampler, 0xFF, 0x100, rate);
+        Resmpl_DevConnect(&resampler, &info);
+        Resmpl_Init(&resampler);
+
+        for (const uint32_t frames : kSizes)
+        {
+            runner.run("resampler " + std::to_string(rate), frames, [&] {
+                std::memset(buffer, 0, sizeof(WAVE_32BS) * frames);
+                Resmpl_Execute(&resampler, frames, buffer);
+                keep(buffer);
+            });
+        }
+
+        Resmpl_Deinit(&resampler);
+    }
+}
+
+/**
+   A note on every channel of @a chip, the built-in patch at full level.
+ */
+static void writeNotes(VgmChip& chip, const FmRegisterImage& image)
+{
+    for (uint8_t c = 0; c < kYm2612Channels; ++c)
+    {
+        ym2612WriteImage(chip, c, image);
+        ym2612WriteLevel(chip, c, image, 0);
+        ym2612WritePitch(chip, c, ym2612Pitch(48.0f + c * 4.0f));
+        ym2612WritePan(chip, c, image, 0xC0);
+        ym2612KeyOn(chip, c);
+    }
+}
+
+static void benchChips(Runner& runner)
+{
+    const PatchLibrary library;
+    const FmRegisterImage& image = library.get(0, 0);
+    static WAVE_32BS buffer[kMaxSize];
+
+    for (const Core& core : kCores)
+    {
+        VgmChip chip;
+
+        if (! chip.start(DEVID_YM2612, kYm2612Clock, static_cast<uint32_t>(kSampleRate), core.fcc))
+        {
+            std::fprintf(stderr, "YM2612 core %s not available, skipped\n", core.name);
+            continue;
+        }
+
+        ym2612Init(chip);
+        writeNotes(chip, image);
+
+        // all six channels held, the chips are cleared and added to as in the engine, resampling included
+        for (const uint32_t frames : kSizes)
+        {
+            runner.run(std::string("ym2612 ") + core.name + " render", frames, [&] {
+                std::memset(buffer, 0, sizeof(WAVE_32BS) * frames);
+                chip.render(frames, buffer);
+                keep(buffer);
+            });
+        }
+
+        // a program change on every channel and the quantum that follows it, which drains the register writes
+        // the cores queue, the difference with the render of 64 frames is the cost of the writes
+        runner.run(std::string("ym2612 ") + core.name + " writes", SynthEngine::kQuantumFrames, [&] {
+            writeNotes(chip, image);
+            std::memset(buffer, 0, sizeof(WAVE_32BS) * SynthEngine::kQuantumFrames);
+            chip.render(SynthEngine::kQuantumFrames, buffer);
+            keep(buffer);
+        });
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool writeJson(const char* filename, const std::vector<Result>& results)
+{
+    json j;
+    j["simd"] = simdName();
+    j["sampleRate"] = kSampleRate;
+    j["results"] = json::array();
+
+    for (const Result& result : results)
+    {
+        j["results"].push_back({ { "name", result.name }, { "frames", result.frames }, { "ns", result.ns },
+                                 { "nsMin", result.nsMin }, { "nsPerFrame", result.ns / result.frames } });
+    }
+
+    std::ofstream file(filename);
+    file << j.dump(2) << '\n';
+    return file.good();
+}
+
+static bool compare(const char* filename, const std::vector<Result>& results)
+{
+    std::map<std::pair<std::string, uint32_t>, double> baseline;
+
+    try {
+        std::ifstream file(filename);
+        const json j = json::parse(file);
+
+        for (const json& result : j.at("results"))
+            baseline[{ result.at("name").get<std::string>(), result.at("frames").get<uint32_t>() }]
+                = result.at("ns").get<double>();
+    }
+    catch (const std::exception& e) {
+        std::fprintf(stderr, "Failed to read %s: %s\n", filename, e.what());
+        return false;
+    }
+
+    std::printf("\nchange from %s, negative is faster\n", filename);
+
+    for (const Result& result : results)
+    {
+        const auto found = baseline.find({ result.name, result.frames });
+
+        if (found == baseline.end() || found->second <= 0.0)
+            std::printf("%-32s %5u          new\n", result.name.c_str(), result.frames);
+        else
+            std::printf("%-32s %5u %+11.1f%%\n", result.name.c_str(), result.frames,
+                        (result.ns / found->second - 1.0) * 100.0);
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // denormals flushed to zero as hosts run their audio threads, the gain kernels would otherwise decay into them
+#if defined(VGM_SIMD_SSE)
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+
+    std::printf("%s kernels, %.0f Hz\n", simdName(), kSampleRate);
+
+    Runner runner(options);
+    benchGain(runner);
+    benchMixer(runner);
+    benchPitch(runner);
+    benchResampler(runner);
+    benchChips(runner);
+
+    if (options.jsonFile != nullptr && ! writeJson(options.jsonFile, runner.getResults()))
+    {
+        std::fprintf(stderr, "Failed to write %s\n", options.jsonFile);
+        return 1;
+    }
+
+    if (options.baselineFile != nullptr && ! compare(options.baselineFile, runner.getResults()))
+        return 1;
+
+    return 0;
+}
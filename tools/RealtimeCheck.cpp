@@ -0,0 +1,398 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+// Realtime-safety checker, interposes the C library functions a realtime thread must not call.
+// Load it before the C library, LD_PRELOAD=libvgm-rtcheck.so for a host, or link it into a test executable.
+// VGM_RT_CHECK_ABORT=1 in the environment aborts at the first violation, for a debugger or a failing test.
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+static constexpr const int kMaxStackFrames = 48;
+static constexpr const uint32_t kMaxReportedStacks = 1024; // each call site is reported once
+
+// static TLS, a preloaded library must not allocate for its thread locals
+#define RTCHECK_TLS __thread __attribute__((tls_model("initial-exec")))
+
+static RTCHECK_TLS uint32_t tDepth = 0;
+static RTCHECK_TLS const char* tContext = nullptr;
+static RTCHECK_TLS bool tReporting = false;
+
+static std::atomic<uint64_t> gReportedStacks[kMaxReportedStacks];
+static std::atomic<uint64_t> gViolations { 0 };
+static bool gAbort = false;
+
+static bool firstReport(void* const* frames, int count) noexcept
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (int i = 0; i < count; ++i)
+        hash = (hash ^ reinterpret_cast<uintptr_t>(frames[i])) * 0x100000001B3ull;
+
+    hash |= 1; // 0 marks a free slot
+
+    for (uint32_t i = 0; i < kMaxReportedStacks; ++i)
+    {
+        std::atomic<uint64_t>& slot = gReportedStacks[(hash + i) % kMaxReportedStacks];
+        uint64_t expected = 0;
+
+        if (slot.compare_exchange_strong(expected, hash))
+            return true;
+        if (expected == hash)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+   Called at the top of every interposed function, reports the call when the thread is in a realtime scope.
+ */
+static void check(const char* function) noexcept
+{
+    if (tDepth == 0 || tReporting)
+        return;
+
+    // the reporting itself may allocate, when backtrace() loads the unwinder
+    tReporting = true;
+    gViolations.fetch_add(1, std::memory_order_relaxed);
+
+    void* frames[kMaxStackFrames];
+    const int count = backtrace(frames, kMaxStackFrames);
+
+    if (firstReport(frames, count))
+    {
+        dprintf(STDERR_FILENO, "rtcheck: %s called in %s\n", function, tContext);
+        // the first frame is check() itself
+        backtrace_symbols_fd(frames + 1, count - 1, STDERR_FILENO);
+    }
+
+    if (gAbort)
+        std::abort();
+
+    tReporting = false;
+}
+
+template <typename Function>
+static Function next(const char* name) noexcept
+{
+    return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+#define RTCHECK_NEXT(function) \
+    static const auto real = next<decltype(&::function)>(#function)
+
+__attribute__((constructor)) static void init() noexcept
+{
+    const char* const abort = std::getenv("VGM_RT_CHECK_ABORT");
+    gAbort = abort != nullptr && abort[0] == '1';
+
+    // loads the unwinder now rather than in the first report
+    void* frames[1];
+    backtrace(frames, 1);
+}
+
+__attribute__((destructor)) static void fini() noexcept
+{
+    const uint64_t violations = gViolations.load(std::memory_order_relaxed);
+
+    if (violations != 0)
+        dprintf(STDERR_FILENO, "rtcheck: %llu realtime violations\n", static_cast<unsigned long long>(violations));
+}
+
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// scopes
+
+extern "C" {
+
+__attribute__((visibility("default"))) void vgm_rtcheck_enter(const char* context) noexcept
+{
+    if (tDepth++ == 0)
+        tContext = context;
+}
+
+__attribute__((visibility("default"))) void vgm_rtcheck_leave() noexcept
+{
+    --tDepth;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// memory, operator new and delete of the C++ library end up here
+
+void* malloc(size_t size)
+{
+    check("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    check("calloc");
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    check("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    check("memalign");
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    check("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    check("posix_memalign");
+
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr != nullptr || size == 0 ? 0 : ENOMEM;
+}
+
+void free(void* ptr)
+{
+    if (ptr != nullptr)
+        check("free");
+    __libc_free(ptr);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// blocking synchronisation, trylock and posting a semaphore are fine
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    RTCHECK_NEXT(pthread_mutex_lock);
+    check("pthread_mutex_lock");
+    return real(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    RTCHECK_NEXT(pthread_cond_wait);
+    check("pthread_cond_wait");
+    return real(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+    RTCHECK_NEXT(pthread_cond_timedwait);
+    check("pthread_cond_timedwait");
+    return real(cond, mutex, abstime);
+}
+
+int pthread_join(pthread_t thread, void** result)
+{
+    RTCHECK_NEXT(pthread_join);
+    check("pthread_join");
+    return real(thread, result);
+}
+
+int sem_wait(sem_t* sem)
+{
+    RTCHECK_NEXT(sem_wait);
+    check("sem_wait");
+    return real(sem);
+}
+
+int sem_timedwait(sem_t* sem, const struct timespec* abstime)
+{
+    RTCHECK_NEXT(sem_timedwait);
+    check("sem_timedwait");
+    return real(sem, abstime);
+}
+
+int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+    RTCHECK_NEXT(nanosleep);
+    check("nanosleep");
+    return real(duration, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const struct timespec* request, struct timespec* remaining)
+{
+    RTCHECK_NEXT(clock_nanosleep);
+    check("clock_nanosleep");
+    return real(clock, flags, request, remaining);
+}
+
+int usleep(useconds_t usec)
+{
+    RTCHECK_NEXT(usleep);
+    check("usleep");
+    return real(usec);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+    RTCHECK_NEXT(sleep);
+    check("sleep");
+    return real(seconds);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// files and console, d_stdout and d_stderr included
+
+int open(const char* path, int flags, ...)
+{
+    RTCHECK_NEXT(open);
+    check("open");
+
+    mode_t mode = 0;
+
+    if ((flags & O_CREAT) != 0)
+    {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+
+    return real(path, flags, mode);
+}
+
+ssize_t read(int fd, void* buffer, size_t size)
+{
+    RTCHECK_NEXT(read);
+    check("read");
+    return real(fd, buffer, size);
+}
+
+ssize_t write(int fd, const void* buffer, size_t size)
+{
+    RTCHECK_NEXT(write);
+    check("write");
+    return real(fd, buffer, size);
+}
+
+FILE* fopen(const char* path, const char* mode)
+{
+    RTCHECK_NEXT(fopen);
+    check("fopen");
+    return real(path, mode);
+}
+
+size_t fwrite(const void* buffer, size_t size, size_t count, FILE* stream)
+{
+    RTCHECK_NEXT(fwrite);
+    check("fwrite");
+    return real(buffer, size, count, stream);
+}
+
+int fflush(FILE* stream)
+{
+    RTCHECK_NEXT(fflush);
+    check("fflush");
+    return real(stream);
+}
+
+int fputs(const char* string, FILE* stream)
+{
+    RTCHECK_NEXT(fputs);
+    check("fputs");
+    return real(string, stream);
+}
+
+int puts(const char* string)
+{
+    RTCHECK_NEXT(puts);
+    check("puts");
+    return real(string);
+}
+
+int vfprintf(FILE* stream, const char* format, va_list args)
+{
+    RTCHECK_NEXT(vfprintf);
+    check("vfprintf");
+    return real(stream, format, args);
+}
+
+int fprintf(FILE* stream, const char* format, ...)
+{
+    RTCHECK_NEXT(vfprintf);
+    check("fprintf");
+
+    va_list args;
+    va_start(args, format);
+    const int ret = real(stream, format, args);
+    va_end(args);
+    return ret;
+}
+
+int printf(const char* format, ...)
+{
+    RTCHECK_NEXT(vfprintf);
+    check("printf");
+
+    va_list args;
+    va_start(args, format);
+    const int ret = real(stdout, format, args);
+    va_end(args);
+    return ret;
+}
+
+// _FORTIFY_SOURCE builds call these instead
+int __vfprintf_chk(FILE* stream, int flag, const char* format, va_list args)
+{
+    RTCHECK_NEXT(__vfprintf_chk);
+    check("vfprintf");
+    return real(stream, flag, format, args);
+}
+
+int __fprintf_chk(FILE* stream, int flag, const char* format, ...)
+{
+    RTCHECK_NEXT(__vfprintf_chk);
+    check("fprintf");
+
+    va_list args;
+    va_start(args, format);
+    const int ret = real(stream, flag, format, args);
+    va_end(args);
+    return ret;
+}
+
+}
+
+// --------------------------------------------------------------------------------------------------------------------
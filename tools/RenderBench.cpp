@@ -0,0 +1,221 @@
+/*
+ * libvgm plugin
+ * SPDX-License-Identifier: ISC
+ */
+
+// Headless renderer, plays a MIDI file through the engine the way the plugin does and times every block.
+
+#include "FmPatch.hpp"
+#include "MidiFile.hpp"
+#include "RealtimeCheck.hpp"
+#include "SynthEngine.hpp"
+
+#include <emu/EmuCores.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Options {
+    const char* midiFile = nullptr;
+    const char* bankFile = nullptr;
+    double sampleRate = 48000.0;
+    uint32_t bufferSize = 256;
+    const char* coreName = "default";
+    uint32_t core = 0;
+    uint32_t repeat = 1;
+    float tail = 2.0f; // seconds rendered after the last event
+    bool multiTimbral = false;
+    bool mpe = false;
+};
+
+static void usage(const char* name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options] file.mid\n"
+                 "  -r, --rate HZ        sample rate (48000)\n"
+                 "  -b, --buffer FRAMES  host block size (256)\n"
+                 "  -c, --core NAME      YM2612 core: default, mame, nuked, gpgx\n"
+                 "  -k, --bank FILE      patch bank to load\n"
+                 "  -n, --repeat COUNT   times the file is played (1)\n"
+                 "  -m, --multi          multi-timbral mode\n"
+                 "      --mpe            MPE mode\n",
+                 name);
+}
+
+static bool parseCore(const char* name, uint32_t& core)
+{
+    if (std::strcmp(name, "default") == 0)
+        core = 0;
+    else if (std::strcmp(name, "mame") == 0)
+        core = FCC_MAME;
+    else if (std::strcmp(name, "nuked") == 0)
+        core = FCC_NUKE;
+    else if (std::strcmp(name, "gpgx") == 0)
+        core = FCC_GPGX;
+    else
+        return false;
+    return true;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* const arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if ((std::strcmp(arg, "-r") == 0 || std::strcmp(arg, "--rate") == 0) && hasValue)
+            options.sampleRate = std::atof(argv[++i]);
+        else if ((std::strcmp(arg, "-b") == 0 || std::strcmp(arg, "--buffer") == 0) && hasValue)
+            options.bufferSize = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if ((std::strcmp(arg, "-c") == 0 || std::strcmp(arg, "--core") == 0) && hasValue)
+        {
+            options.coreName = argv[++i];
+
+            if (! parseCore(options.coreName, options.core))
+                return false;
+        }
+        else if ((std::strcmp(arg, "-k") == 0 || std::strcmp(arg, "--bank") == 0) && hasValue)
+            options.bankFile = argv[++i];
+        else if ((std::strcmp(arg, "-n") == 0 || std::strcmp(arg, "--repeat") == 0) && hasValue)
+            options.repeat = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (std::strcmp(arg, "-m") == 0 || std::strcmp(arg, "--multi") == 0)
+            options.multiTimbral = true;
+        else if (std::strcmp(arg, "--mpe") == 0)
+            options.mpe = true;
+        else if (arg[0] != '-' && options.midiFile == nullptr)
+            options.midiFile = arg;
+        else
+            return false;
+    }
+
+    return options.midiFile != nullptr && options.sampleRate >= 8000.0
+        && options.bufferSize > 0 && options.repeat > 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    const size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    if (! parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TimedMidiEvent> events;
+    std::string error;
+
+    if (! loadMidiFile(options.midiFile, options.sampleRate, events, error))
+    {
+        std::fprintf(stderr, "Failed to load %s: %s\n", options.midiFile, error.c_str());
+        return 1;
+    }
+
+    SynthEngine engine;
+    engine.setSampleRate(options.sampleRate);
+    engine.setEmuCore(options.core);
+    engine.setMultiTimbral(options.multiTimbral);
+    engine.setMpe(options.mpe);
+
+    if (options.bankFile != nullptr)
+    {
+        PatchLibrary library;
+
+        if (! loadPatchLibrary(options.bankFile, library, error))
+        {
+            std::fprintf(stderr, "Failed to load bank %s: %s\n", options.bankFile, error.c_str());
+            return 1;
+        }
+
+        engine.setLibrary(library);
+    }
+
+    engine.activate();
+
+    const uint64_t songFrames = (events.empty() ? 0 : events.back().frame)
+                              + static_cast<uint64_t>(options.tail * options.sampleRate);
+    const uint32_t blockSize = options.bufferSize;
+    std::vector<float> outL(blockSize), outR(blockSize);
+    std::vector<double> blockTimes;
+    blockTimes.reserve(static_cast<size_t>(songFrames / blockSize + 1) * options.repeat);
+
+    typedef std::chrono::steady_clock Clock;
+    double totalTime = 0.0;
+
+    for (uint32_t r = 0; r < options.repeat; ++r)
+    {
+        size_t next = 0;
+
+        // same order as the plugin run(), events at their frame offset and the chips rendered in between
+        for (uint64_t blockStart = 0; blockStart < songFrames; blockStart += blockSize)
+        {
+            const uint32_t frames = static_cast<uint32_t>(std::min<uint64_t>(blockSize, songFrames - blockStart));
+            const Clock::time_point start = Clock::now();
+            uint32_t done = 0;
+
+            VGM_REALTIME_SCOPE("vgm-render-bench block");
+
+            for (; next < events.size() && events[next].frame < blockStart + frames; ++next)
+            {
+                const uint32_t frame = static_cast<uint32_t>(std::max(events[next].frame, blockStart) - blockStart);
+
+                if (frame > done)
+                {
+                    engine.render(outL.data() + done, outR.data() + done, frame - done);
+                    done = frame;
+                }
+
+                engine.handleMidi(events[next].data, events[next].size);
+            }
+
+            if (done < frames)
+                engine.render(outL.data() + done, outR.data() + done, frames - done);
+
+            const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            blockTimes.push_back(elapsed);
+            totalTime += elapsed;
+        }
+
+        engine.allNotesOff();
+    }
+
+    engine.deactivate();
+
+    if (blockTimes.empty())
+    {
+        std::fprintf(stderr, "Nothing to render\n");
+        return 1;
+    }
+
+    const double audioTime = static_cast<double>(songFrames) * options.repeat / options.sampleRate;
+    const double budget = blockSize / options.sampleRate;
+
+    std::sort(blockTimes.begin(), blockTimes.end());
+
+    std::printf("%s: %zu events, %.0f Hz, %u frames per block, core %s\n", options.midiFile, events.size(),
+                options.sampleRate, blockSize, options.coreName);
+    std::printf("rendered %.2f s in %.3f s, %.1fx realtime\n", audioTime, totalTime, audioTime / totalTime);
+    std::printf("block us: mean %.2f, p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f, budget %.2f\n",
+                totalTime / blockTimes.size() * 1e6,
+                percentile(blockTimes, 50.0) * 1e6, percentile(blockTimes, 90.0) * 1e6,
+                percentile(blockTimes, 99.0) * 1e6, percentile(blockTimes, 99.9) * 1e6,
+                blockTimes.back() * 1e6, budget * 1e6);
+
+    return 0;
+}